@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "Ans.h"
+#include "BitIO.h"
+#include "CodeTable.h"
+
+using namespace std;
+
+static inline int high_bit(uint32_t v) {
+    return 31 - __builtin_clz(v);
+}
+
+void normalizeCounts(const long long int Count[], int table_log, uint16_t norm[]) {
+    const int64_t states = 1 << table_log;
+    long long int total = 0;
+    for (int c = 0; c < Char_size; c++) total += Count[c];
+    int64_t sum = 0;
+    for (int c = 0; c < Char_size; c++) {
+        norm[c] = 0;
+        if (!Count[c]) continue;
+        int64_t n = (Count[c] * states + total / 2) / total;
+        norm[c] = n > 0 ? n : 1;
+        sum += norm[c];
+    }
+    //rounding and the minimum of 1 leave the sum a little off, take the difference from the
+    //characters that lose the fewest bits by it
+    while (sum != states) {
+        int best = -1;
+        double best_cost = 0;
+        for (int c = 0; c < Char_size; c++) {
+            if (!norm[c] || (sum > states && norm[c] == 1)) continue;
+            double cost = sum > states ? Count[c] * log2((double)norm[c] / (norm[c] - 1))
+                                       : -Count[c] * log2((double)(norm[c] + 1) / norm[c]);
+            if (best < 0 || cost < best_cost) {
+                best = c;
+                best_cost = cost;
+            }
+        }
+        if (sum > states) {
+            norm[best]--;
+            sum--;
+        } else {
+            norm[best]++;
+            sum++;
+        }
+    }
+}
+
+uint64_t ansCost(const long long int Count[], const uint16_t norm[], int table_log) {
+    double bits = 0;
+    for (int c = 0; c < Char_size; c++)
+        if (Count[c]) bits += Count[c] * (table_log - log2((double)norm[c]));
+    return (uint64_t)bits;
+}
+
+unsigned char *writeNormalized(const uint16_t norm[], int table_log, unsigned char *out) {
+    *out++ = table_log;
+    memset(out, 0, 32);
+    for (int c = 0; c < Char_size; c++)
+        if (norm[c]) out[c / 8] |= 1 << (c % 8);
+    BitWriter writer(out + 32);
+    for (int c = 0; c < Char_size; c++) {
+        if (!norm[c]) continue;
+        writer.put(norm[c] - 1, table_log);
+        writer.flush();
+    }
+    return writer.finish();
+}
+
+const unsigned char *readNormalized(const unsigned char *in, const unsigned char *end, uint16_t norm[], int &table_log) {
+    if (end - in < 33) return NULL;
+    table_log = in[0];
+    if (table_log < Ans_min_table_log || table_log > Ans_max_table_log) return NULL;
+    const unsigned char *present = in + 1;
+    int used = 0;
+    for (int c = 0; c < Char_size; c++) used += (present[c / 8] >> (c % 8)) & 1;
+    const unsigned char *stop = present + 32 + (used * table_log + 7) / 8;
+    if (stop > end) return NULL;
+    BitReader reader(present + 32, stop);
+    int64_t sum = 0;
+    for (int c = 0; c < Char_size; c++) {
+        norm[c] = 0;
+        if (!((present[c / 8] >> (c % 8)) & 1)) continue;
+        reader.refill();
+        norm[c] = reader.peek(table_log) + 1;
+        reader.consume(table_log);
+        sum += norm[c];
+    }
+    return sum == (1 << table_log) ? stop : NULL;
+}
+
+// Character of every state: each character's states are spread over the whole table with
+// an odd step, so every character has states of each size
+static void spread_symbols(const uint16_t norm[], int table_log, uint8_t symbols[]) {
+    const uint32_t mask = (1 << table_log) - 1;
+    const uint32_t step = (mask + 1) / 2 + (mask + 1) / 8 + 3;
+    uint32_t position = 0;
+    for (int c = 0; c < Char_size; c++)
+        for (int i = 0; i < norm[c]; i++) {
+            symbols[position] = c;
+            position = (position + step) & mask;
+        }
+}
+
+unsigned char *ansEncode(const unsigned char *data, size_t size, const uint16_t norm[], int table_log, unsigned char *out) {
+    const uint32_t states = 1 << table_log;
+    uint8_t symbols[1 << Ans_max_table_log];
+    spread_symbols(norm, table_log, symbols);
+
+    //states of every character sorted by their place in the table, and per character the
+    //offsets that turn a state into the bits to write and the index of the next state
+    uint16_t next_state[1 << Ans_max_table_log];
+    uint32_t first[Char_size + 1];
+    first[0] = 0;
+    for (int c = 0; c < Char_size; c++) first[c + 1] = first[c] + norm[c];
+    uint32_t cumulative[Char_size];
+    memcpy(cumulative, first, sizeof(cumulative));
+    for (uint32_t u = 0; u < states; u++) next_state[cumulative[symbols[u]]++] = states + u;
+    uint32_t delta_bits[Char_size];
+    int32_t delta_state[Char_size];
+    for (int c = 0; c < Char_size; c++) {
+        if (norm[c] == 0) continue;
+        if (norm[c] == 1) {
+            delta_bits[c] = (table_log << 16) - states;
+            delta_state[c] = first[c] - 1;
+        } else {
+            uint32_t max_bits = table_log - high_bit(norm[c] - 1);
+            delta_bits[c] = (max_bits << 16) - (norm[c] << max_bits);
+            delta_state[c] = first[c] - norm[c];
+        }
+    }
+
+    //characters go in backwards so the decoder reads them forwards, even positions take the
+    //first state and odd ones the second
+    BitWriter writer(out);
+    uint32_t state[2] = {states, states};
+    auto put = [&](unsigned char c, uint32_t &s) {
+        uint32_t bits = (s + delta_bits[c]) >> 16;
+        writer.put_bits(s & ((1u << bits) - 1), bits);
+        s = next_state[(s >> bits) + delta_state[c]];
+    };
+    size_t i = size;
+    if (i & 1) {
+        put(data[--i], state[0]);
+        writer.flush();
+    }
+    static_assert(4 * Ans_max_table_log <= 56, "four characters must fit between two flushes");
+    if (i & 2) {
+        put(data[i - 1], state[1]);
+        put(data[i - 2], state[0]);
+        writer.flush();
+        i -= 2;
+    }
+    while (i > 0) {
+        put(data[i - 1], state[1]);
+        put(data[i - 2], state[0]);
+        put(data[i - 3], state[1]);
+        put(data[i - 4], state[0]);
+        writer.flush();
+        i -= 4;
+    }
+    //final states, read first, and a 1 bit marking where the stream ends
+    writer.put(state[1] - states, table_log);
+    writer.put(state[0] - states, table_log);
+    writer.put(1, 1);
+    return writer.finish();
+}
+
+void buildAnsDecodeTable(const uint16_t norm[], int table_log, AnsDecodeTable &table) {
+    const uint32_t states = 1 << table_log;
+    uint8_t symbols[1 << Ans_max_table_log];
+    spread_symbols(norm, table_log, symbols);
+    uint32_t next[Char_size];
+    for (int c = 0; c < Char_size; c++) next[c] = norm[c];
+    table.table_log = table_log;
+    table.entries.resize(states);
+    for (uint32_t u = 0; u < states; u++) {
+        uint8_t c = symbols[u];
+        uint32_t x = next[c]++;
+        int bits = table_log - high_bit(x);
+        table.entries[u] = AnsEntry{(uint16_t)((x << bits) - states), c, (uint8_t)bits};
+    }
+}
+
+// Bits [position, position + bits) of a stream packed most significant bit first, bits
+// outside the stream read as zeros
+static uint32_t bits_at(const unsigned char *in, size_t in_size, int64_t position, int bits) {
+    if (position < 0) return 0;
+    unsigned char window[8] = {0};
+    size_t byte = position >> 3;
+    if (byte < in_size) memcpy(window, in + byte, min<size_t>(8, in_size - byte));
+    return (uint32_t)((load_be64(window) << (position & 7)) >> 1 >> (63 - bits));
+}
+
+bool ansDecode(const AnsDecodeTable &table, const unsigned char *in, size_t in_size, unsigned char *out, size_t size) {
+    const int table_log = table.table_log;
+    const AnsEntry *entries = table.entries.data();
+    if (in_size == 0 || in[in_size - 1] == 0) return false;
+    //the stream is read backwards from the 1 bit at its end
+    int64_t position = (int64_t)in_size * 8 - __builtin_ctz(in[in_size - 1]) - 1;
+    uint32_t state[2];
+    for (int k = 0; k < 2; k++) {
+        position -= table_log;
+        state[k] = bits_at(in, in_size, position, table_log);
+    }
+
+    //a 64-bit window ending at the current position serves four characters. Its unread bits
+    //are kept right-aligned, so each character's bits are the lowest ones and the loop only
+    //does table lookups, masks, shifts and adds
+    static_assert(4 * Ans_max_table_log <= 56, "four characters must fit in one window");
+    uint32_t first = state[0], second = state[1];
+    size_t i = 0;
+    while (size - i >= 4 && position >= 64) {
+        const int64_t start = (position >> 3) - 7;
+        const int unread = position - start * 8; //56 to 63 bits of the window before the position
+        uint64_t window = load_be64(in + start) >> (64 - unread);
+        int consumed = 0;
+        for (int k = 0; k < 2; k++) {
+            AnsEntry e1 = entries[first], e2 = entries[second];
+            out[i] = e1.symbol;
+            out[i + 1] = e2.symbol;
+            first = e1.next + (uint32_t)(window & ((1u << e1.bits) - 1));
+            window >>= e1.bits;
+            second = e2.next + (uint32_t)(window & ((1u << e2.bits) - 1));
+            window >>= e2.bits;
+            consumed += e1.bits + e2.bits;
+            i += 2;
+        }
+        position -= consumed;
+    }
+    state[0] = first;
+    state[1] = second;
+    for (; i < size; i++) {
+        AnsEntry e = entries[state[i & 1]];
+        out[i] = e.symbol;
+        position -= e.bits;
+        state[i & 1] = e.next + bits_at(in, in_size, position, e.bits);
+    }
+    //the encoder started from state 0 of both and wrote nothing before the first character
+    return position == 0 && state[0] == 0 && state[1] == 0;
+}
@@ -0,0 +1,46 @@
+#ifndef ANS_H
+#define ANS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define Ans_table_log 11 // the tables have 2^11 states
+#define Ans_min_table_log 8 // room for every character
+#define Ans_max_table_log 11 // a character never takes more bits than this, like Max_code_length
+#define Ans_header_max (1 + 32 + 256 * Ans_max_table_log / 8 + 1) // largest normalized frequency header
+
+// Frequencies scaled to sum to 2^table_log, every character that occurs keeps at least 1.
+// Rounding is corrected on the characters where it costs the fewest bits
+void normalizeCounts(const long long int Count[], int table_log, uint16_t norm[]);
+
+// Estimated size in bits of coding characters with these counts and normalized frequencies
+uint64_t ansCost(const long long int Count[], const uint16_t norm[], int table_log);
+
+// Table log, bitmap of the characters present and their normalized frequency minus one in
+// table_log bits each. read returns NULL if the header is cut short or does not add up
+unsigned char *writeNormalized(const uint16_t norm[], int table_log, unsigned char *out);
+const unsigned char *readNormalized(const unsigned char *in, const unsigned char *end, uint16_t norm[], int &table_log);
+
+// Encode size characters with two interleaved tANS states into at most table_log bits per
+// character plus 3 bytes, and out needs 8 spare bytes after that. Returns the end of the stream
+unsigned char *ansEncode(const unsigned char *data, size_t size, const uint16_t norm[], int table_log, unsigned char *out);
+
+// One decoding state: the character it stands for, the bits to read and the base of the next state
+struct AnsEntry {
+    uint16_t next;
+    uint8_t symbol;
+    uint8_t bits;
+};
+
+struct AnsDecodeTable {
+    std::vector<AnsEntry> entries; // 2^table_log states
+    int table_log;
+};
+
+void buildAnsDecodeTable(const uint16_t norm[], int table_log, AnsDecodeTable &table);
+
+// Decode size characters, false if the stream does not end exactly in the starting states
+bool ansDecode(const AnsDecodeTable &table, const unsigned char *in, size_t in_size, unsigned char *out, size_t size);
+
+#endif
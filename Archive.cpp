@@ -0,0 +1,339 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "Archive.h"
+#include "Format.h"
+#include "FileIO.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+#define Archive_entry_size 26 // fixed part of a file table entry, before the path
+
+// Regular files under root/relative, paths relative to root in sorted order so the archive does
+// not depend on the directory listing order. skip is the archive itself when it lies inside
+static bool list_files(const string &root, const string &relative, const struct stat &skip, vector<ArchiveEntry> &files) {
+    string path = relative.empty() ? root : root + "/" + relative;
+    DIR *dir = opendir(path.c_str());
+    if (!dir) {
+        cerr << "Error: Could not open directory " << path << "\n";
+        return false;
+    }
+    vector<string> names;
+    while (dirent *item = readdir(dir))
+        if (strcmp(item->d_name, ".") != 0 && strcmp(item->d_name, "..") != 0) names.push_back(item->d_name);
+    closedir(dir);
+    sort(names.begin(), names.end());
+
+    for (const string &name : names) {
+        string child = relative.empty() ? name : relative + "/" + name;
+        struct stat info;
+        if (lstat((root + "/" + child).c_str(), &info) != 0) continue; //removed in the meantime
+        if (S_ISDIR(info.st_mode)) {
+            if (!list_files(root, child, skip, files)) return false;
+        } else if (S_ISREG(info.st_mode) && !(info.st_dev == skip.st_dev && info.st_ino == skip.st_ino)) {
+            if (child.size() > 0xFFFF) {
+                cerr << "Error: Path too long for the file table: " << child << "\n";
+                return false;
+            }
+            files.push_back(ArchiveEntry{child, (uint64_t)info.st_size, 0, 0});
+        }
+    }
+    return true;
+}
+
+// A file with at least a wave of blocks keeps every thread busy on its own
+static bool is_large(uint64_t size, uint64_t block_size, int threads) {
+    return size >= block_size * 2 * threads;
+}
+
+bool compressDirectory(const string &directory, const string &archive_filename, const CompressOptions &options,
+                       vector<ArchiveEntry> &entries) {
+    entries.clear();
+    if (options.block_size == 0 || options.block_size > Max_block_size) {
+        cerr << "Error: Block size must be between 1 byte and 1 GB.\n";
+        return false;
+    }
+    OutputFile output;
+    struct stat archive_info;
+    if (!output.open(archive_filename) || stat(archive_filename.c_str(), &archive_info) != 0) {
+        cerr << "Error: Could not create output file at " << archive_filename << "\n";
+        return false;
+    }
+    if (!list_files(directory, "", archive_info, entries)) {
+        output.close();
+        remove(archive_filename.c_str());
+        return false;
+    }
+
+    //the files add their phases, the wall time is the archive's own
+    JobStats *stats = options.stats;
+    const uint64_t wall_before = stats ? stats->wall_nanoseconds.load() : 0, start_time = stats ? nanoseconds_now() : 0;
+    JobProgress *progress = options.progress;
+    if (progress && !progress->total) {
+        uint64_t total = 0;
+        for (const ArchiveEntry &entry : entries) total += entry.size;
+        progress->total = total;
+    }
+    unique_ptr<ThreadPool> own_pool;
+    if (options.threads > 0) own_pool.reset(new ThreadPool(options.threads));
+    ThreadPool &pool = own_pool ? *own_pool : ThreadPool::shared();
+
+    unsigned char header[Archive_header_size] = {0};
+    memcpy(header, Archive_magic, 4);
+    header[4] = Archive_version;
+    output.write(header, Archive_header_size);
+
+    //small files longest first, so the short ones are left for the end of every share
+    vector<size_t> small, large;
+    for (size_t i = 0; i < entries.size(); i++)
+        (is_large(entries[i].size, options.block_size, pool.size()) ? large : small).push_back(i);
+    stable_sort(small.begin(), small.end(), [&](size_t a, size_t b) { return entries[a].size > entries[b].size; });
+
+    atomic<bool> failed{false};
+    mutex output_lock; //the output file and error messages
+    auto fail = [&](const string &message) {
+        lock_guard<mutex> guard(output_lock);
+        if (!failed.exchange(true)) cerr << "Error: " << message << "\n";
+    };
+    auto stopped = [&] { return failed || (progress && progress->cancelled()); };
+
+    //one encoder and output buffer per thread, each file compressed whole in memory
+    vector<Encoder> encoders(pool.size(), Encoder(options));
+    vector<vector<unsigned char>> packed(pool.size());
+    pool.parallel_steal(small.size(), [&](size_t k, int thread) {
+        if (stopped()) return;
+        ArchiveEntry &entry = entries[small[k]];
+        InputFile input;
+        if (!input.open(directory + "/" + entry.path) || !input.mapped()) return fail("Could not read " + entry.path);
+        entry.size = input.size();
+        if (!encoders[thread].compress(input.data(), input.size(), packed[thread])) return fail("Could not compress " + entry.path);
+        {
+            lock_guard<mutex> guard(output_lock);
+            entry.offset = output.position();
+            entry.compressed_size = packed[thread].size();
+            if (!output.write(packed[thread].data(), packed[thread].size())) failed = true;
+        }
+        if (progress) progress->add(entry.size);
+    });
+
+    //large files one at a time, all threads on their blocks
+    for (size_t i : large) {
+        if (stopped()) break;
+        ArchiveEntry &entry = entries[i];
+        InputFile input;
+        if (!input.open(directory + "/" + entry.path)) {
+            fail("Could not read " + entry.path);
+            break;
+        }
+        if (input.mapped()) entry.size = input.size();
+        entry.offset = output.position();
+        if (!compressInto(input, output, options)) {
+            if (!stopped()) fail("Could not compress " + entry.path);
+            break;
+        }
+        entry.compressed_size = output.position() - entry.offset;
+    }
+
+    // File table and footer
+    uint64_t table_offset = output.position();
+    vector<unsigned char> table;
+    for (const ArchiveEntry &entry : entries) {
+        unsigned char fixed[Archive_entry_size];
+        fixed[0] = entry.path.size() & 0xFF;
+        fixed[1] = entry.path.size() >> 8;
+        store_le64(fixed + 2, entry.size);
+        store_le64(fixed + 10, entry.offset);
+        store_le64(fixed + 18, entry.compressed_size);
+        table.insert(table.end(), fixed, fixed + 2);
+        table.insert(table.end(), entry.path.begin(), entry.path.end());
+        table.insert(table.end(), fixed + 2, fixed + Archive_entry_size);
+    }
+    output.write(table.data(), table.size());
+    unsigned char footer[Archive_footer_size] = {0};
+    store_le64(footer, table_offset);
+    store_le64(footer + 8, entries.size());
+    memcpy(footer + 16, Archive_footer_magic, 4);
+    output.write(footer, Archive_footer_size);
+
+    bool success = output.close() && !stopped();
+    if (!success) remove(archive_filename.c_str()); //no partial archive
+    if (stats) stats->wall_nanoseconds = wall_before + nanoseconds_now() - start_time;
+    return success;
+}
+
+// No two entries share a path and no file is also a directory of another entry, so every
+// entry writes a file of its own when extracted in parallel
+static bool distinct_paths(const vector<ArchiveEntry> &entries) {
+    vector<string> paths;
+    paths.reserve(entries.size());
+    for (const ArchiveEntry &entry : entries) paths.push_back(entry.path);
+    sort(paths.begin(), paths.end());
+    if (adjacent_find(paths.begin(), paths.end()) != paths.end()) return false;
+    for (const string &path : paths)
+        for (size_t slash = path.find('/'); slash != string::npos; slash = path.find('/', slash + 1))
+            if (binary_search(paths.begin(), paths.end(), path.substr(0, slash))) return false;
+    return true;
+}
+
+// File table of an archive in memory, false if the footer or the table does not make sense
+static bool read_table(const unsigned char *input, uint64_t size, vector<ArchiveEntry> &entries) {
+    entries.clear();
+    if (size < Archive_header_size + Archive_footer_size || memcmp(input, Archive_magic, 4) != 0 || input[4] != Archive_version)
+        return false;
+    const uint64_t end = size - Archive_footer_size;
+    const unsigned char *footer = input + end;
+    if (memcmp(footer + 16, Archive_footer_magic, 4) != 0) return false;
+    uint64_t table_offset = load_le64(footer), count = load_le64(footer + 8);
+    if (table_offset < Archive_header_size || table_offset > end || count > (end - table_offset) / Archive_entry_size) return false;
+
+    const unsigned char *p = input + table_offset, *stop = input + end;
+    for (uint64_t i = 0; i < count; i++) {
+        if (stop - p < 2) return false;
+        size_t length = p[0] | (p[1] << 8);
+        if ((size_t)(stop - p) < Archive_entry_size + length) return false;
+        ArchiveEntry entry;
+        entry.path.assign((const char *)p + 2, length);
+        p += 2 + length;
+        entry.size = load_le64(p);
+        entry.offset = load_le64(p + 8);
+        entry.compressed_size = load_le64(p + 16);
+        p += Archive_entry_size - 2;
+        if (entry.offset < Archive_header_size || entry.offset > table_offset || entry.compressed_size > table_offset - entry.offset)
+            return false;
+        entries.push_back(entry);
+    }
+    return p == stop && distinct_paths(entries);
+}
+
+bool listArchive(const string &archive_filename, vector<ArchiveEntry> &entries) {
+    InputFile input;
+    if (!input.open(archive_filename) || !input.mapped()) {
+        cerr << "Error: Could not open input file.\n";
+        return false;
+    }
+    if (!read_table(input.data(), input.size(), entries)) {
+        cerr << "Error: Not an archive, or its file table is damaged.\n";
+        return false;
+    }
+    return true;
+}
+
+// A relative path without empty, "." or ".." components, so it stays inside the directory
+static bool safe_path(const string &path) {
+    if (path.empty() || path[0] == '/' || path.find('\0') != string::npos) return false;
+    size_t start = 0;
+    while (true) {
+        size_t end = path.find('/', start);
+        string part = path.substr(start, end == string::npos ? string::npos : end - start);
+        if (part.empty() || part == "." || part == "..") return false;
+        if (end == string::npos) return true;
+        start = end + 1;
+    }
+}
+
+// Create the directories leading to root/path, those that exist already are fine
+static bool make_parents(const string &root, const string &path) {
+    for (size_t slash = path.find('/'); slash != string::npos; slash = path.find('/', slash + 1))
+        if (mkdir((root + "/" + path.substr(0, slash)).c_str(), 0755) != 0 && errno != EEXIST) return false;
+    return true;
+}
+
+bool extractArchive(const string &archive_filename, const string &directory, const DecompressOptions &options) {
+    InputFile input;
+    vector<ArchiveEntry> entries;
+    if (!input.open(archive_filename) || !input.mapped()) {
+        cerr << "Error: Could not open input file.\n";
+        return false;
+    }
+    if (!read_table(input.data(), input.size(), entries)) {
+        cerr << "Error: Not an archive, or its file table is damaged.\n";
+        return false;
+    }
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        cerr << "Error: Could not create directory " << directory << "\n";
+        return false;
+    }
+
+    JobStats *stats = options.stats;
+    const uint64_t wall_before = stats ? stats->wall_nanoseconds.load() : 0, start_time = stats ? nanoseconds_now() : 0;
+    unique_ptr<ThreadPool> own_pool;
+    if (options.threads > 0) own_pool.reset(new ThreadPool(options.threads));
+    ThreadPool &pool = own_pool ? *own_pool : ThreadPool::shared();
+
+    //every path and member is checked and every directory made before any file is written
+    vector<size_t> small, large;
+    uint64_t total = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        const ArchiveEntry &entry = entries[i];
+        const unsigned char *member = input.data() + entry.offset;
+        uint64_t original;
+        if (!safe_path(entry.path)) {
+            cerr << "Error: Refusing to extract " << entry.path << "\n";
+            return false;
+        }
+        if (!Decoder::originalSize(member, entry.compressed_size, original) || original != entry.size) {
+            cerr << "Error: " << entry.path << " is corrupt.\n";
+            return false;
+        }
+        if (!make_parents(directory, entry.path)) {
+            cerr << "Error: Could not create the directories of " << entry.path << "\n";
+            return false;
+        }
+        //dictionary messages have no blocks to spread over the threads
+        bool blocks = member[3] == Huf_version_blocks;
+        (blocks && is_large(entry.size, max<uint32_t>(load_le32(member + 4), 1), pool.size()) ? large : small).push_back(i);
+        total += entry.size;
+    }
+    JobProgress *progress = options.progress;
+    if (progress && !progress->total) progress->total = total;
+    stable_sort(small.begin(), small.end(), [&](size_t a, size_t b) { return entries[a].size > entries[b].size; });
+
+    atomic<bool> failed{false};
+    mutex message_lock;
+    auto fail = [&](const string &path) {
+        remove((directory + "/" + path).c_str()); //no incomplete file
+        lock_guard<mutex> guard(message_lock);
+        if (!failed.exchange(true) && !(progress && progress->cancelled())) cerr << "Error: Could not extract " << path << "\n";
+    };
+    auto stopped = [&] { return failed || (progress && progress->cancelled()); };
+
+    //one decoder per thread, each file decoded whole straight into its mapped output
+    vector<Decoder> decoders(pool.size(), Decoder(options));
+    pool.parallel_steal(small.size(), [&](size_t k, int thread) {
+        if (stopped()) return;
+        const ArchiveEntry &entry = entries[small[k]];
+        const unsigned char *member = input.data() + entry.offset;
+        OutputFile output;
+        if (!output.open(directory + "/" + entry.path)) return fail(entry.path);
+        bool ok;
+        size_t written;
+        if (unsigned char *out = output.map(entry.size)) {
+            ok = decoders[thread].decompress(member, entry.compressed_size, out, entry.size, written) && written == entry.size;
+        } else {
+            vector<unsigned char> data;
+            ok = decoders[thread].decompress(member, entry.compressed_size, data) && output.write(data.data(), data.size());
+        }
+        if (!output.close() || !ok) return fail(entry.path);
+        if (progress) progress->add(entry.size);
+    });
+
+    //large files one at a time, all threads on their blocks
+    for (size_t i : large) {
+        if (stopped()) break;
+        const ArchiveEntry &entry = entries[i];
+        OutputFile output;
+        bool ok = output.open(directory + "/" + entry.path) &&
+                  decompressInto(input.data() + entry.offset, entry.compressed_size, output, options);
+        if (!output.close() || !ok) fail(entry.path);
+    }
+    if (stats) stats->wall_nanoseconds = wall_before + nanoseconds_now() - start_time;
+    return !stopped();
+}
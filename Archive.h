@@ -0,0 +1,33 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Encode.h"
+#include "Decode.h"
+
+// One file of an archive
+struct ArchiveEntry {
+    std::string path;         // relative to the archived directory, '/' between components
+    uint64_t size;            // original size
+    uint64_t offset;          // start of the file's .huf data in the archive
+    uint64_t compressed_size; // length of the file's .huf data
+};
+
+// Compress every regular file under directory into one archive. Files too small to keep every
+// thread busy on their own are compressed side by side on a work-stealing pool, larger ones one
+// after another with their blocks in parallel. entries receives the file table. Symbolic links
+// and empty directories are not stored. A cancelled or failed run removes the archive
+bool compressDirectory(const std::string &directory, const std::string &archive_filename, const CompressOptions &options,
+                       std::vector<ArchiveEntry> &entries);
+
+// Read the file table of an archive
+bool listArchive(const std::string &archive_filename, std::vector<ArchiveEntry> &entries);
+
+// Recreate every file of an archive under directory, in parallel the same way as compressDirectory.
+// Paths that would leave directory are refused. Files left incomplete by a failure or a
+// cancellation are removed
+bool extractArchive(const std::string &archive_filename, const std::string &directory, const DecompressOptions &options);
+
+#endif
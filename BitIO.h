@@ -0,0 +1,133 @@
+#ifndef BIT_IO_H
+#define BIT_IO_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// Load 8 bytes as a big-endian 64-bit word, the first byte ends up in the top bits
+inline uint64_t load_be64(const unsigned char *p) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return __builtin_bswap64(v);
+#else
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+    return v;
+#endif
+}
+
+// Store a 64-bit word big-endian, the top bits go to the first byte
+inline void store_be64(unsigned char *p, uint64_t v) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+    memcpy(p, &v, 8);
+#else
+    for (int i = 7; i >= 0; i--) {
+        p[i] = (unsigned char)v;
+        v >>= 8;
+    }
+#endif
+}
+
+// Packs codes most significant bit first through a 64-bit accumulator. flush() stores the
+// whole accumulator and advances by the completed bytes, so the destination needs 8 spare bytes
+class BitWriter {
+public:
+    BitWriter() : out(NULL), acc(0), count(0) {}
+    explicit BitWriter(unsigned char *dst) : out(dst), acc(0), count(0) {}
+
+    // Append the low length bits of code, at most 56 bits between two flushes
+    inline void put(uint64_t code, int length) {
+        acc |= code << (64 - length - count);
+        count += length;
+    }
+
+    // Same as put, but length may also be 0
+    inline void put_bits(uint64_t code, int length) {
+        acc |= code << 1 << (63 - length - count);
+        count += length;
+    }
+
+    inline void flush() {
+        store_be64(out, acc);
+        out += count >> 3;
+        acc <<= count & ~7;
+        count &= 7;
+    }
+
+    // Write out the last partial byte padded with zeros, returns the end of the data
+    unsigned char *finish() {
+        flush();
+        if (count) {
+            *out++ = (unsigned char)(acc >> 56);
+            acc = 0;
+            count = 0;
+        }
+        return out;
+    }
+
+    unsigned char *position() const { return out; }
+    void rebase(unsigned char *dst) { out = dst; }
+    int pending_bits() const { return count; }
+
+private:
+    unsigned char *out;
+    uint64_t acc; // pending bits, left aligned
+    int count;    // number of pending bits
+};
+
+// Reads a most-significant-bit-first stream from a memory range through a 64-bit buffer.
+// Reading past the end yields zero bits, like the padding at the end of a .huf file
+class BitReader {
+public:
+    BitReader() : cur(NULL), end(NULL), buffer(0), count(0), overrun(0) {}
+    BitReader(const unsigned char *begin, const unsigned char *stop)
+        : cur(begin), end(stop), buffer(0), count(0), overrun(0) {}
+
+    // Continue reading from a new range, bits already buffered are kept
+    void rebase(const unsigned char *begin, const unsigned char *stop) {
+        cur = begin;
+        end = stop;
+    }
+
+    // Top up the buffer to at least 56 bits
+    inline void refill() {
+        if (end - cur >= 8) {
+            buffer |= load_be64(cur) >> count;
+            cur += (63 - count) >> 3;
+            count |= 56;
+            return;
+        }
+        while (count <= 56) {
+            uint64_t byte = 0;
+            if (cur < end) byte = *cur++;
+            else overrun++;
+            buffer |= byte << (56 - count);
+            count += 8;
+        }
+    }
+
+    inline unsigned peek(int bits) const { return (unsigned)(buffer >> (64 - bits)); }
+    inline void consume(int bits) {
+        buffer <<= bits;
+        count -= bits;
+    }
+
+    const unsigned char *position() const { return cur; }
+    size_t bytes_left() const { return end - cur; }
+    // Zero bytes fed in after the end of the input
+    long long overrun_bytes() const { return overrun; }
+    // True once bits after the end of the input have been consumed
+    bool exhausted() const { return overrun * 8 > count; }
+
+private:
+    const unsigned char *cur;
+    const unsigned char *end;
+    uint64_t buffer; // unread bits, left aligned
+    int count;       // number of valid bits in buffer
+    long long overrun;
+};
+
+#endif
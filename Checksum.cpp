@@ -0,0 +1,140 @@
+#include <cstring>
+#include "Checksum.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define Crc_hardware 1
+#endif
+
+#define Crc_polynomial 0x82F63B78 // Castagnoli, reflected
+
+// table[k][b] is the CRC of byte b followed by k zero bytes, so 8 bytes are folded in
+// with 8 independent lookups
+struct CrcTable {
+    uint32_t table[8][256];
+
+    CrcTable() {
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t crc = b;
+            for (int i = 0; i < 8; i++) crc = (crc >> 1) ^ (crc & 1 ? Crc_polynomial : 0);
+            table[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256; b++)
+            for (int k = 1; k < 8; k++) table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+    }
+};
+
+static uint32_t crc32c_table(uint32_t crc, const unsigned char *data, size_t size) {
+    static const CrcTable tables;
+    const uint32_t(*t)[256] = tables.table;
+    while (size >= 8) {
+        uint32_t low = (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24)) ^ crc;
+        uint32_t high = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t)data[7] << 24);
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+              t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+        data += 8;
+        size -= 8;
+    }
+    while (size--) crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+    return crc;
+}
+
+#ifdef Crc_hardware
+#define Crc_long_lane 8192 // bytes per lane of the three-lane loop over long inputs
+#define Crc_short_lane 256 // and over what is left of them
+
+// 32x32 bit matrix over GF(2), one column per bit, times a vector
+static uint32_t gf2_times(const uint32_t *matrix, uint32_t vector) {
+    uint32_t sum = 0;
+    for (; vector; vector >>= 1, matrix++)
+        if (vector & 1) sum ^= *matrix;
+    return sum;
+}
+
+static void gf2_square(uint32_t *square, const uint32_t *matrix) {
+    for (int n = 0; n < 32; n++) square[n] = gf2_times(matrix, matrix[n]);
+}
+
+// Tables that move a CRC past length zero bytes (a power of two), so the CRCs of lanes
+// computed side by side can be chained
+struct CrcShift {
+    uint32_t table[4][256];
+
+    explicit CrcShift(size_t length) {
+        uint32_t even[32], odd[32];
+        odd[0] = Crc_polynomial; //one zero bit
+        for (int n = 1; n < 32; n++) odd[n] = 1u << (n - 1);
+        gf2_square(even, odd); //two zero bits
+        gf2_square(odd, even); //four zero bits
+        uint32_t *op = even;
+        while (true) { //squaring doubles the zero bytes, starting from one
+            gf2_square(even, odd);
+            op = even;
+            if ((length >>= 1) == 0) break;
+            gf2_square(odd, even);
+            op = odd;
+            if ((length >>= 1) == 0) break;
+        }
+        for (int k = 0; k < 4; k++)
+            for (uint32_t b = 0; b < 256; b++) table[k][b] = gf2_times(op, b << (8 * k));
+    }
+
+    uint32_t shift(uint32_t crc) const {
+        return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+    }
+};
+
+// The crc32 instruction takes a few cycles before its result can be fed back, three
+// independent lanes keep it busy every cycle
+template <size_t Lane>
+__attribute__((target("sse4.2"))) static inline uint32_t crc32c_lanes(uint32_t crc, const unsigned char *&data, size_t &size,
+                                                                      const CrcShift &shift) {
+#ifdef __x86_64__
+    while (size >= 3 * Lane) {
+        uint64_t crc0 = crc, crc1 = 0, crc2 = 0;
+        for (size_t i = 0; i < Lane; i += 8) {
+            uint64_t word0, word1, word2;
+            memcpy(&word0, data + i, 8);
+            memcpy(&word1, data + Lane + i, 8);
+            memcpy(&word2, data + 2 * Lane + i, 8);
+            crc0 = _mm_crc32_u64(crc0, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+        }
+        crc = shift.shift((uint32_t)crc0) ^ (uint32_t)crc1;
+        crc = shift.shift(crc) ^ (uint32_t)crc2;
+        data += 3 * Lane;
+        size -= 3 * Lane;
+    }
+#endif
+    return crc;
+}
+
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, size_t size) {
+    static const CrcShift long_shift(Crc_long_lane), short_shift(Crc_short_lane);
+    crc = crc32c_lanes<Crc_long_lane>(crc, data, size, long_shift);
+    crc = crc32c_lanes<Crc_short_lane>(crc, data, size, short_shift);
+#ifdef __x86_64__
+    uint64_t wide = crc;
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        wide = _mm_crc32_u64(wide, word);
+        data += 8;
+        size -= 8;
+    }
+    crc = (uint32_t)wide;
+#endif
+    while (size--) crc = _mm_crc32_u8(crc, *data++);
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const unsigned char *data, size_t size) {
+    crc = ~crc;
+#ifdef Crc_hardware
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    if (hardware) return ~crc32c_sse42(crc, data, size);
+#endif
+    return ~crc32c_table(crc, data, size);
+}
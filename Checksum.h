@@ -0,0 +1,11 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli) of data, continuing from crc (0 to start a new one). Uses the SSE4.2
+// crc32 instruction when the CPU has it, 8 bytes at a time, and a sliced table otherwise
+uint32_t crc32c(uint32_t crc, const unsigned char *data, size_t size);
+
+#endif
@@ -0,0 +1,212 @@
+#include <algorithm>
+#include "CodeTable.h"
+
+using namespace std;
+
+// Node of the flat binary trie rebuilt from the codes
+struct TrieNode {
+    int child[2];
+    int character; // -1 for internal nodes
+};
+
+// Fill 2^width slots starting at base with the codes continuing below node
+static bool fill_table(const vector<TrieNode> &trie, const vector<int> &height, vector<int> &sub_table,
+                       vector<DecodeEntry> &entries, size_t base, int node, int width, bool pairs) {
+    for (int pattern = 0; pattern < (1 << width); pattern++) {
+        int n = node, used = 0;
+        while (used < width && trie[n].character < 0) { //walk down the trie bit by bit, as the old decoder did
+            n = trie[n].child[(pattern >> (width - 1 - used)) & 1];
+            if (n < 0) break;
+            used++;
+        }
+        DecodeEntry entry = {0, 0, 0};
+        if (n < 0) { //no code starts with this pattern
+            entries[base + pattern] = entry;
+            continue;
+        }
+        if (trie[n].character >= 0) {
+            entry.value = trie[n].character;
+            entry.bits = used;
+            entry.count = 1;
+            if (pairs) { //try to fit a second complete code into the leftover bits
+                int m = 0, extra = 0;
+                while (used + extra < width && trie[m].character < 0) {
+                    m = trie[m].child[(pattern >> (width - 1 - used - extra)) & 1];
+                    if (m < 0) break;
+                    extra++;
+                }
+                if (m >= 0 && trie[m].character >= 0) {
+                    entry.value |= trie[m].character << 8;
+                    entry.bits += extra;
+                    entry.count = 2;
+                }
+            }
+        } else { //code is longer than this table, continue in a sub-table of node n
+            if (sub_table[n] < 0) {
+                int sub_width = min(Sub_table_bits, height[n]);
+                size_t offset = entries.size();
+                if (offset + (1 << sub_width) > 0xFFFF + 1) return false;
+                entries.resize(offset + (1 << sub_width));
+                sub_table[n] = offset;
+                if (!fill_table(trie, height, sub_table, entries, offset, n, sub_width, false)) return false;
+            }
+            entry.value = sub_table[n];
+            entry.bits = min(Sub_table_bits, height[n]);
+        }
+        entries[base + pattern] = entry;
+    }
+    return true;
+}
+
+// Character of the package-merge algorithm, sorted by count
+struct Leaf {
+    long long int weight;
+    int character;
+};
+
+// Optimal code lengths no longer than max_length for the given frequencies (package-merge).
+// Only fixed-size arrays on the stack, no heap allocation
+void limitCodeLengths(const long long int Count[], int max_length, uint8_t lengths[]) {
+    Leaf leaves[Char_size];
+    int n = 0;
+    for (int c = 0; c < Char_size; c++) {
+        lengths[c] = 0;
+        if (Count[c]) leaves[n++] = Leaf{Count[c], c};
+    }
+    sort(leaves, leaves + n, [](const Leaf &a, const Leaf &b) {
+        return a.weight != b.weight ? a.weight < b.weight : a.character < b.character;
+    });
+    max_length = min(max_length, Max_code_length);
+
+    //list k holds the cheapest coins of denomination 2^-(max_length - k), merged from the
+    //leaves and packages of pairs from list k - 1. Only the weights of the previous list and
+    //which coins were leaves are kept
+    static const int Max_coins = 2 * Char_size;
+    long long int weight[2][Max_coins];
+    bool is_leaf[Max_code_length][Max_coins];
+    for (int i = 0; i < n; i++) {
+        weight[0][i] = leaves[i].weight;
+        is_leaf[0][i] = true;
+    }
+    int size = n;
+    for (int k = 1; k < max_length; k++) {
+        const long long int *previous = weight[(k - 1) & 1];
+        long long int *current = weight[k & 1];
+        int leaf = 0, pair = 0, count = 0;
+        while (leaf < n || pair + 1 < size) {
+            bool take_leaf = pair + 1 >= size || (leaf < n && leaves[leaf].weight <= previous[pair] + previous[pair + 1]);
+            is_leaf[k][count] = take_leaf;
+            if (take_leaf) {
+                current[count++] = leaves[leaf++].weight;
+            } else {
+                current[count++] = previous[pair] + previous[pair + 1];
+                pair += 2;
+            }
+        }
+        size = count;
+    }
+
+    //the 2n - 2 cheapest coins of the last list are taken. The leaves among the first m coins
+    //of a list are the m' cheapest characters, each one bit longer, and its packages take the
+    //first coins of the list before
+    int taken = 2 * n - 2;
+    for (int k = max_length - 1; k >= 0 && taken > 0; k--) {
+        int leaf_count = 0;
+        for (int i = 0; i < taken; i++) leaf_count += is_leaf[k][i];
+        for (int i = 0; i < leaf_count; i++) lengths[leaves[i].character]++;
+        taken = 2 * (taken - leaf_count);
+    }
+}
+
+// Assign canonical codes from the code lengths
+void canonicalCodes(const uint8_t lengths[], CodeTable &codes) {
+    int length_count[65] = {0};
+    for (int c = 0; c < Char_size; c++)
+        length_count[lengths[c]]++;
+    length_count[0] = 0;
+    uint64_t next_code[65] = {0};
+    uint64_t code = 0;
+    for (int length = 1; length <= 64; length++) {
+        code = (code + length_count[length - 1]) << 1;
+        next_code[length] = code;
+    }
+    for (int c = 0; c < Char_size; c++) {
+        codes.length[c] = lengths[c];
+        codes.code[c] = lengths[c] ? next_code[lengths[c]]++ : 0;
+    }
+}
+
+// Codes no longer than Table_bits each cover a run of primary slots, no trie needed
+static bool fill_short_codes(const CodeTable &codes, DecodeTable &table) {
+    const int size = 1 << Table_bits;
+    table.entries.assign(size, DecodeEntry{0, 0, 0});
+    DecodeEntry *entries = table.entries.data();
+    for (int c = 0; c < Char_size; c++) {
+        int length = codes.length[c];
+        if (!length) continue;
+        if (codes.code[c] >> length) return false;
+        int first = codes.code[c] << (Table_bits - length);
+        int last = first + (1 << (Table_bits - length));
+        for (int i = first; i < last; i++) {
+            if (entries[i].count) return false; //two codes share a prefix
+            entries[i] = DecodeEntry{(uint16_t)c, (uint8_t)length, 1};
+        }
+    }
+    //the bits left over after the first code select the second one, slots already
+    //turned into pairs still hold their first character in the low byte
+    for (int i = 0; i < size; i++) {
+        DecodeEntry &entry = entries[i];
+        if (!entry.count) continue;
+        const DecodeEntry &next = entries[(i << entry.bits) & (size - 1)];
+        int next_length = codes.length[next.value & 0xFF];
+        if (next.count && entry.bits + next_length <= Table_bits) {
+            entry.value |= (next.value & 0xFF) << 8;
+            entry.bits += next_length;
+            entry.count = 2;
+        }
+    }
+    return true;
+}
+
+// Build the decode table for a prefix-free code of at least two characters
+bool buildDecodeTable(const CodeTable &codes, DecodeTable &table) {
+    int max_length = 0, used_characters = 0;
+    for (int c = 0; c < Char_size; c++) {
+        max_length = max(max_length, (int)codes.length[c]);
+        used_characters += codes.length[c] != 0;
+    }
+    if (used_characters < 2) return false;
+    copy(codes.length, codes.length + Char_size, table.length);
+    if (max_length <= Table_bits) return fill_short_codes(codes, table);
+
+    vector<TrieNode> trie(1, TrieNode{{-1, -1}, -1});
+    for (int c = 0; c < Char_size; c++) {
+        int length = codes.length[c];
+        if (!length) continue;
+        if (length > 64) return false;
+        int n = 0;
+        for (int i = length - 1; i >= 0; i--) {
+            if (trie[n].character >= 0) return false; //another code is a prefix of this one
+            int bit = (codes.code[c] >> i) & 1;
+            if (trie[n].child[bit] < 0) {
+                trie[n].child[bit] = trie.size();
+                trie.push_back(TrieNode{{-1, -1}, -1});
+            }
+            n = trie[n].child[bit];
+        }
+        if (trie[n].character >= 0 || trie[n].child[0] >= 0 || trie[n].child[1] >= 0)
+            return false; //this code is a prefix of another one
+        trie[n].character = c;
+    }
+
+    //children are always created after their parent, so one backwards pass gives subtree heights
+    vector<int> height(trie.size(), 0);
+    for (int n = trie.size() - 1; n >= 0; n--)
+        for (int bit = 0; bit < 2; bit++)
+            if (trie[n].child[bit] >= 0)
+                height[n] = max(height[n], height[trie[n].child[bit]] + 1);
+
+    vector<int> sub_table(trie.size(), -1);
+    table.entries.assign(1 << Table_bits, DecodeEntry{0, 0, 0});
+    return fill_table(trie, height, sub_table, table.entries, 0, 0, Table_bits, true);
+}
@@ -0,0 +1,44 @@
+#ifndef CODE_TABLE_H
+#define CODE_TABLE_H
+
+#include <cstdint>
+#include <vector>
+
+#define Char_size 256 // ASCII character set only
+#define Table_bits 11 // bits peeked by one lookup in the primary decode table
+#define Sub_table_bits 7 // widest second level table for codes longer than Table_bits
+#define Max_code_length 11 // longest code written in the current format, one table lookup decodes any code
+
+// Binary Huffman code of every byte value, stored most significant bit first
+struct CodeTable {
+    uint64_t code[Char_size];
+    uint8_t length[Char_size]; // 0 for characters that never occur
+};
+
+// One slot of the multi-bit decode table
+struct DecodeEntry {
+    uint16_t value; // decoded characters (first | second << 8), or offset of a sub-table
+    uint8_t bits;   // bits consumed by the decoded characters, or index width of the sub-table
+    uint8_t count;  // characters decoded by this slot (1 or 2), 0 if value points to a sub-table
+};
+
+// Lookup table replacing the bit-by-bit tree walk. The first 2^Table_bits entries
+// are indexed by the next Table_bits of input, longer codes continue in sub-tables.
+// A slot with count == 0 and bits == 0 is a bit pattern no code starts with
+struct DecodeTable {
+    std::vector<DecodeEntry> entries;
+    uint8_t length[Char_size]; // code length of every character
+};
+
+// Optimal code lengths no longer than max_length for the given frequencies (package-merge).
+// Needs at least two characters with a nonzero count and 2^max_length >= that number
+void limitCodeLengths(const long long int Count[], int max_length, uint8_t lengths[]);
+
+// Assign canonical codes from the code lengths: shorter codes first, equal lengths by character
+void canonicalCodes(const uint8_t lengths[], CodeTable &codes);
+
+// Build the decode table for a prefix-free code of at least two characters,
+// false if the code is not a valid one
+bool buildDecodeTable(const CodeTable &codes, DecodeTable &table);
+
+#endif
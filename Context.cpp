@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "Context.h"
+#include "BitIO.h"
+#include "Format.h"
+
+using namespace std;
+
+#define Table_cost_bits (Huf_lengths_size * 8) // code lengths stored for one more table
+
+// Bits per character under the counts of a cluster, smoothed so characters it has not seen
+// yet cost a lot but not infinitely much
+static void cluster_bits(const long long int Count[], double bits[]) {
+    double total = 0;
+    for (int c = 0; c < Char_size; c++) total += Count[c];
+    for (int c = 0; c < Char_size; c++) bits[c] = log2((total + Char_size / 2) / (Count[c] + 0.5));
+}
+
+// Characters that follow one context and how often, a short list for most contexts
+struct Followers {
+    const uint32_t *count;
+    const uint8_t *character;
+    int size;
+};
+
+// Bits of coding the characters of one context with the given bits per character
+static double context_cost(const Followers &f, const double bits[]) {
+    double sum = 0;
+    for (int i = 0; i < f.size; i++) sum += f.count[i] * bits[f.character[i]];
+    return sum;
+}
+
+int clusterContexts(const unsigned char *data, size_t size, size_t run, int max_tables, ContextScratch &scratch) {
+    vector<uint32_t> &counts = scratch.counts;
+    counts.assign(Char_size * Char_size, 0);
+    for (size_t first = 0; first < size; first += run) {
+        size_t last = min(first + run, size);
+        unsigned previous = 0;
+        for (size_t i = first; i < last; i++) {
+            counts[previous * Char_size + data[i]]++;
+            previous = data[i];
+        }
+    }
+
+    //contexts that occur with their followers, heaviest first
+    int active[Char_size], n = 0, start[Char_size + 1];
+    uint64_t weight[Char_size];
+    scratch.follower_count.clear();
+    scratch.follower.clear();
+    for (int p = 0; p < Char_size; p++) {
+        weight[p] = 0;
+        start[p] = scratch.follower.size();
+        for (int c = 0; c < Char_size; c++) {
+            uint32_t count = counts[p * Char_size + c];
+            if (!count) continue;
+            weight[p] += count;
+            scratch.follower_count.push_back(count);
+            scratch.follower.push_back(c);
+        }
+        if (weight[p]) active[n++] = p;
+    }
+    start[Char_size] = scratch.follower.size();
+    memset(scratch.map, 0, sizeof(scratch.map));
+    if (n == 0) return 0;
+    sort(active, active + n, [&](int a, int b) { return weight[a] != weight[b] ? weight[a] > weight[b] : a < b; });
+    max_tables = max(1, min({max_tables, n, Max_context_tables}));
+    Followers followers[Char_size];
+    for (int i = 0; i < n; i++) {
+        int p = active[i];
+        followers[i] = Followers{&scratch.follower_count[start[p]], &scratch.follower[start[p]], start[p + 1] - start[p]};
+    }
+
+    //seeds: the heaviest context, then every time the context that its closest cluster so far
+    //codes worst compared to its own statistics, while that loses more than a table costs
+    double bits[Max_context_tables][Char_size];
+    double own[Char_size], best[Char_size];
+    long long int(*cluster)[Char_size] = scratch.cluster;
+    for (int i = 0; i < n; i++) {
+        const uint32_t *h = &counts[active[i] * Char_size];
+        long long int single[Char_size];
+        for (int c = 0; c < Char_size; c++) single[c] = h[c];
+        double self[Char_size];
+        cluster_bits(single, self);
+        own[i] = context_cost(followers[i], self);
+        best[i] = HUGE_VAL;
+    }
+    int tables = 0;
+    int seed = 0;
+    while (true) {
+        const uint32_t *h = &counts[active[seed] * Char_size];
+        for (int c = 0; c < Char_size; c++) cluster[tables][c] = h[c];
+        cluster_bits(cluster[tables], bits[tables]);
+        tables++;
+        if (tables == max_tables) break;
+        double worst = 0;
+        for (int i = 0; i < n; i++) {
+            best[i] = min(best[i], context_cost(followers[i], bits[tables - 1]));
+            if (best[i] - own[i] > worst) {
+                worst = best[i] - own[i];
+                seed = i;
+            }
+        }
+        if (worst < Table_cost_bits) break;
+    }
+
+    //a few rounds of moving every context to the cluster that codes it best, then rebuilding
+    //the clusters from their contexts. Clusters left without contexts are dropped
+    uint8_t assigned[Char_size];
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < n; i++) {
+            double lowest = HUGE_VAL;
+            for (int k = 0; k < tables; k++) {
+                double cost = context_cost(followers[i], bits[k]);
+                if (cost < lowest) {
+                    lowest = cost;
+                    assigned[i] = k;
+                }
+            }
+        }
+        int renumber[Max_context_tables], kept = 0;
+        bool used[Max_context_tables] = {false};
+        for (int i = 0; i < n; i++) used[assigned[i]] = true;
+        for (int k = 0; k < tables; k++) renumber[k] = used[k] ? kept++ : -1;
+        tables = kept;
+        memset(cluster, 0, sizeof(scratch.cluster));
+        for (int i = 0; i < n; i++) {
+            assigned[i] = renumber[assigned[i]];
+            const Followers &f = followers[i];
+            for (int j = 0; j < f.size; j++) cluster[assigned[i]][f.character[j]] += f.count[j];
+        }
+        for (int k = 0; k < tables; k++) cluster_bits(cluster[k], bits[k]);
+    }
+    for (int i = 0; i < n; i++) scratch.map[active[i]] = assigned[i];
+    return tables;
+}
+
+unsigned char *contextEncode(const unsigned char *data, size_t size, const uint8_t map[], const CodeTable codes[], int streams,
+                             unsigned char *out) {
+    static_assert(4 * Max_code_length <= 56, "four codes must fit between two flushes");
+    *out++ = streams;
+    unsigned char *jump = out, *end = out + 4 * (streams - 1);
+    size_t run = (size + streams - 1) / streams;
+    for (int k = 0; k < streams; k++) {
+        const unsigned char *in = data + min(k * run, size), *in_end = data + min(k * run + run, size);
+        unsigned char *start = end;
+        BitWriter writer(end);
+        unsigned previous = 0;
+        auto put = [&](unsigned c) {
+            const CodeTable &table = codes[map[previous]];
+            writer.put(table.code[c], table.length[c]);
+            previous = c;
+        };
+        for (; in_end - in >= 4; in += 4) {
+            put(in[0]);
+            put(in[1]);
+            put(in[2]);
+            put(in[3]);
+            writer.flush();
+        }
+        for (; in < in_end; in++) {
+            put(*in);
+            writer.flush();
+        }
+        end = writer.finish();
+        if (k < streams - 1) store_le32(jump + 4 * k, end - start);
+    }
+    return end;
+}
+
+bool buildContextDecodeTable(const uint8_t map[], const uint8_t lengths[][Char_size], int tables, ContextDecodeTable &table) {
+    const int slots = 1 << Max_code_length;
+    table.entries.assign((size_t)tables * slots, ContextEntry{0, 0});
+    for (int t = 0; t < tables; t++) {
+        int kraft = 0; //slots taken, a prefix code fits in the table
+        for (int c = 0; c < Char_size; c++) {
+            if (lengths[t][c] > Max_code_length) return false;
+            if (lengths[t][c]) kraft += slots >> lengths[t][c];
+        }
+        if (kraft > slots) return false;
+        CodeTable codes;
+        canonicalCodes(lengths[t], codes);
+        ContextEntry *entries = &table.entries[(size_t)t * slots];
+        for (int c = 0; c < Char_size; c++) {
+            int length = codes.length[c];
+            if (!length) continue;
+            int first = codes.code[c] << (Max_code_length - length);
+            for (int i = 0; i < slots >> length; i++) entries[first + i] = ContextEntry{(uint8_t)c, (uint8_t)length};
+        }
+    }
+    for (int p = 0; p < Char_size; p++) {
+        if (map[p] >= tables) return false;
+        table.base[p] = map[p] * slots;
+    }
+    return true;
+}
+
+// Decode N streams in the same loop, each a chain of lookups that depend on the character
+// before, so the chains of different streams overlap in the CPU
+template <int N>
+static bool decode_runs(const ContextDecodeTable &table, BitReader readers[], unsigned char *out[], unsigned char *end[]) {
+    BitReader reader[N];
+    unsigned char *o[N];
+    unsigned previous[N];
+    for (int s = 0; s < N; s++) {
+        reader[s] = readers[s];
+        o[s] = out[s];
+        previous[s] = 0;
+    }
+    const ContextEntry *entries = table.entries.data();
+    const uint32_t *base = table.base;
+    int invalid = 0; //set by a slot no code starts with, checked once at the end
+
+    auto step = [&](int s) {
+        ContextEntry entry = entries[base[previous[s]] + reader[s].peek(Max_code_length)];
+        invalid |= entry.bits == 0;
+        reader[s].consume(entry.bits);
+        *o[s]++ = entry.symbol;
+        previous[s] = entry.symbol;
+    };
+    //the first stream is the longest, the last one may be shorter
+    auto room = [&]() {
+        for (int s = 0; s < N; s++)
+            if (end[s] - o[s] < 4) return false;
+        return true;
+    };
+    static_assert(4 * Max_code_length <= 56, "four lookups must fit in one refill");
+    while (room()) {
+#pragma GCC unroll 8
+        for (int s = 0; s < N; s++) reader[s].refill();
+#pragma GCC unroll 4
+        for (int k = 0; k < 4; k++)
+#pragma GCC unroll 8
+            for (int s = 0; s < N; s++) step(s);
+    }
+    for (int s = 0; s < N; s++) {
+        while (o[s] < end[s]) {
+            reader[s].refill();
+            step(s);
+        }
+        if (reader[s].exhausted()) return false;
+    }
+    return !invalid;
+}
+
+bool contextDecode(const ContextDecodeTable &table, const unsigned char *in, size_t in_size, unsigned char *out, size_t size) {
+    if (in_size < 1) return false;
+    int streams = in[0];
+    if (streams < 1 || streams > Max_streams || in_size < 1 + 4 * (size_t)(streams - 1)) return false;
+    const unsigned char *jump = in + 1, *p = jump + 4 * (streams - 1), *in_end = in + in_size;
+    size_t run = (size + streams - 1) / streams;
+
+    BitReader readers[Max_streams];
+    unsigned char *starts[Max_streams], *ends[Max_streams];
+    for (int k = 0; k < streams; k++) {
+        size_t length = k < streams - 1 ? load_le32(jump + 4 * k) : in_end - p;
+        if (length > (size_t)(in_end - p)) return false;
+        readers[k] = BitReader(p, p + length);
+        p += length;
+        size_t first = min(k * run, size);
+        starts[k] = out + first;
+        ends[k] = out + min(first + run, size);
+    }
+
+    switch (streams) {
+    case 1: return decode_runs<1>(table, readers, starts, ends);
+    case 2: return decode_runs<2>(table, readers, starts, ends);
+    case 3: return decode_runs<3>(table, readers, starts, ends);
+    case 4: return decode_runs<4>(table, readers, starts, ends);
+    case 5: return decode_runs<5>(table, readers, starts, ends);
+    case 6: return decode_runs<6>(table, readers, starts, ends);
+    case 7: return decode_runs<7>(table, readers, starts, ends);
+    default: return decode_runs<8>(table, readers, starts, ends);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "CodeTable.h"
+
+#define Max_context_tables 16 // code tables of one order-1 block, the map holds 4 bits per context
+
+// Order-1 statistics of a block and the code tables chosen for them, kept from one block
+// to the next
+struct ContextScratch {
+    std::vector<uint32_t> counts;         // counts[previous * Char_size + c]
+    std::vector<uint32_t> follower_count; // the nonzero counts of every context that occurs, one after another
+    std::vector<uint8_t> follower;        // and their characters
+    uint8_t map[Char_size];               // cluster of every previous byte
+    long long int cluster[Max_context_tables][Char_size]; // characters coded with the table of each cluster
+    uint8_t lengths[Max_context_tables][Char_size];
+    CodeTable codes[Max_context_tables];
+};
+
+// Count the characters of data by the byte before them (0 at the start of every run of
+// run bytes) and group the 256 contexts into at most max_tables clusters with similar
+// statistics, filling scratch.map and scratch.cluster. Returns the number of clusters, 0 for
+// no data
+int clusterContexts(const unsigned char *data, size_t size, size_t run, int max_tables, ContextScratch &scratch);
+
+// Code size characters in streams equal runs, each its own stream whose characters use the
+// codes of the cluster of the byte before them. out needs room for size codes of
+// Max_code_length bits plus the jump table and 8 spare bytes. Returns the end of the data
+unsigned char *contextEncode(const unsigned char *data, size_t size, const uint8_t map[], const CodeTable codes[], int streams,
+                             unsigned char *out);
+
+// One slot of a context decode table: the character and the bits of its code, 0 bits for
+// a bit pattern no code starts with
+struct ContextEntry {
+    uint8_t symbol;
+    uint8_t bits;
+};
+
+// Every cluster's table of 2^Max_code_length slots back to back, one lookup per character
+// with no sub-tables. The previous byte picks the table through base, with no pointers
+struct ContextDecodeTable {
+    std::vector<ContextEntry> entries;
+    uint32_t base[Char_size]; // first slot of the table of every previous byte
+};
+
+// Build the tables from the map and the code lengths of tables clusters, false when the
+// lengths are not a prefix code
+bool buildContextDecodeTable(const uint8_t map[], const uint8_t lengths[][Char_size], int tables, ContextDecodeTable &table);
+
+// Decode the streams of contextEncode into size characters, false if they are not valid
+bool contextDecode(const ContextDecodeTable &table, const unsigned char *in, size_t in_size, unsigned char *out, size_t size);
+
+#endif
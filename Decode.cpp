@@ -1,108 +1,1009 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
-#include <ctime>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
 #include "Decode.h"
+#include "CodeTable.h"
+#include "BitIO.h"
+#include "Format.h"
+#include "ThreadPool.h"
+#include "FileIO.h"
+#include "Lz.h"
+#include "Dictionary.h"
+#include "Checksum.h"
 
 using namespace std;
 
-// Structure of a Node of a Huffman tree for decoding
+// Node of a Huffman tree for decoding, children are indices into the same array
 struct Node {
+    int left, right; // -1 for a leaf
     unsigned char character;
-    Node *left;
-    Node *right;
-    
-    Node(char c, Node *l = NULL, Node *r = NULL) : character(c), left(l), right(r) {}
 };
 
-// Rebuild Huffman tree from compressed file data
-Node *Make_Huffman_tree(ifstream &input) {
-    char ch;
-    input.get(ch);
-    if (ch == '1') {
-        input.get(ch);
-        return new Node(ch);
+// Rebuild Huffman tree from compressed file data into nodes (room for 2 * Char_size - 1),
+// in pre-order so nodes[0] is the root and parents come before their children. Returns
+// the number of nodes, 0 if the data ends in the middle or holds more nodes than a tree of
+// Char_size leaves
+int Make_Huffman_tree(const unsigned char *&input, const unsigned char *end, Node nodes[]) {
+    static const int Max_nodes = 2 * Char_size - 1;
+    int open[Max_nodes]; //internal nodes still missing their right child
+    int size = 0, used = 0;
+    do {
+        if (input == end || used == Max_nodes) return 0;
+        Node &node = nodes[used];
+        node.left = node.right = -1;
+        bool leaf = *input++ == '1';
+        if (leaf) {
+            if (input == end) return 0;
+            node.character = *input++;
+        }
+        if (used > 0) { //attach to the innermost open node, left child first
+            Node &parent = nodes[open[size - 1]];
+            if (parent.left < 0) {
+                parent.left = used;
+            } else {
+                parent.right = used;
+                size--;
+            }
+        }
+        if (!leaf) open[size++] = used;
+        used++;
+    } while (size > 0);
+    return used;
+}
+
+// Collect the code of every leaf, most significant bit first
+static bool collect_codes(const Node nodes[], int count, CodeTable &codes) {
+    uint64_t code[2 * Char_size - 1];
+    int length[2 * Char_size - 1];
+    code[0] = length[0] = 0;
+    for (int i = 0; i < count; i++) {
+        if (length[i] > 64) return false; //tree too deep for a 64-bit code
+        if (nodes[i].left < 0) {
+            codes.code[nodes[i].character] = code[i];
+            codes.length[nodes[i].character] = length[i];
+            continue;
+        }
+        code[nodes[i].left] = code[i] << 1;
+        code[nodes[i].right] = (code[i] << 1) | 1;
+        length[nodes[i].left] = length[nodes[i].right] = length[i] + 1;
+    }
+    return true;
+}
+
+// Output of a file with a single distinct character, which has no encoded bits
+static bool write_repeated(OutputFile &output, unsigned char character, uint64_t Total_Freq) {
+    unsigned char *out = output.map(Total_Freq);
+    if (out) {
+        memset(out, character, Total_Freq);
+        return true;
+    }
+    vector<unsigned char> buffer(min<uint64_t>(Total_Freq, Io_buffer_size), character);
+    while (Total_Freq > 0) {
+        uint64_t n = min<uint64_t>(Total_Freq, buffer.size());
+        if (!output.write(buffer.data(), n)) return false;
+        Total_Freq -= n;
+    }
+    return true;
+}
+
+// Look up the next one or two characters, following sub-tables for long codes.
+// The bits of the final slot are left for the caller to consume
+static inline bool lookup(BitReader &reader, const DecodeEntry *entries, DecodeEntry &entry) {
+    reader.refill();
+    int width = Table_bits;
+    entry = entries[reader.peek(width)];
+    while (entry.count == 0) { //code longer than the table, continue in the sub-table
+        if (entry.bits == 0) return false; //no code starts with these bits
+        reader.consume(width);
+        reader.refill();
+        width = entry.bits;
+        entry = entries[entry.value + reader.peek(width)];
+    }
+    return true;
+}
+
+// Decode the next size characters. A pair slot that straddles the end only yields its first
+// character and only consumes that one's bits, so decoding can resume with the same reader
+static bool decode_symbols(const DecodeTable &table, BitReader &state, unsigned char *out, size_t size) {
+    BitReader reader = state; //a local copy stays in registers, stores to out cannot alias it
+    const DecodeEntry *entries = table.entries.data();
+    unsigned char *end = out + size;
+    DecodeEntry entry;
+
+    if (table.entries.size() == (1 << Table_bits)) {
+        //no sub-tables: a slot takes at most Table_bits, so one refill serves four lookups
+        static_assert(4 * Table_bits <= 56, "four lookups must fit in one refill");
+        while (end - out >= 8) {
+            reader.refill();
+            for (int k = 0; k < 4; k++) {
+                entry = entries[reader.peek(Table_bits)];
+                if (!entry.count) return false; //no code starts with these bits
+                out[0] = entry.value & 0xFF;
+                out[1] = entry.value >> 8;
+                out += entry.count;
+                reader.consume(entry.bits);
+            }
+        }
+    }
+    while (end - out >= 2) {
+        if (!lookup(reader, entries, entry)) return false;
+        out[0] = entry.value & 0xFF;
+        out[1] = entry.value >> 8;
+        out += entry.count;
+        reader.consume(entry.bits);
+    }
+    if (out < end) { //last character, the second one of a pair belongs to the next call
+        if (!lookup(reader, entries, entry)) return false;
+        *out++ = entry.value & 0xFF;
+        reader.consume(entry.count == 2 ? entry.bits - table.length[entry.value >> 8] : entry.bits);
+    }
+    state = reader;
+    return true;
+}
+
+// Decode size characters from a complete bit stream in memory
+static bool decode_buffer(const DecodeTable &table, const unsigned char *in, size_t in_size, unsigned char *out, size_t size) {
+    BitReader reader(in, in + in_size);
+    return decode_symbols(table, reader, out, size) && !reader.exhausted();
+}
+
+// Decode the bit stream with multi-bit table lookups instead of walking the tree per bit,
+// straight into the mapped output file when possible
+bool decode(const unsigned char *input, size_t input_size, OutputFile &output, const DecodeTable &table, uint64_t Total_Freq) {
+    BitReader reader(input, input + input_size);
+    unsigned char *out = output.map(Total_Freq);
+    if (out) {
+        if (!decode_symbols(table, reader, out, Total_Freq)) return false;
     } else {
-        Node *left = Make_Huffman_tree(input);
-        Node *right = Make_Huffman_tree(input);
-        return new Node(-1, left, right);
+        vector<unsigned char> buffer(min<uint64_t>(Total_Freq, Io_buffer_size));
+        while (Total_Freq > 0) {
+            size_t n = min<uint64_t>(Total_Freq, buffer.size());
+            if (!decode_symbols(table, reader, buffer.data(), n) || !output.write(buffer.data(), n)) return false;
+            Total_Freq -= n;
+        }
+    }
+    if (reader.exhausted()) {
+        cerr << "Error: Compressed data ended early.\n";
+        return false;
     }
+    return true;
 }
 
-// Decode each binary symbol based on Huffman tree structure
-void decode(ifstream &input, const string &output_filename, Node *Root, long long int Total_Freq) {
-    ofstream output(output_filename.c_str(), ios::binary);
-    if (!output.good()) {
-        cerr << "Error: Could not create output file.\n";
-        exit(-1);
-    }
-
-    bool eof_flag = false; //flag to denote end of decoding
-    char bits_8; //varaiable to hold data from input
-    Node *pointer = Root;
-    while (input.get(bits_8)) { //read one byte at a time
-        int counter = 7;
-        while (counter >= 0) {
-            if (!pointer->left && !pointer->right) { //checks for leaf node, which represents actual characters
-                output << pointer->character;
-                Total_Freq--;
-                if (!Total_Freq) { //checks if all characters have been decoded
-                    eof_flag = true;
-                    break;
+// Unpack the 4-bit code lengths, returns the number of characters with a code
+static int read_lengths(const unsigned char *packed, uint8_t lengths[], int &last) {
+    int used = 0;
+    for (int i = 0; i < Char_size; i++) {
+        lengths[i] = (packed[i / 2] >> (4 * (i & 1))) & 0x0F;
+        if (lengths[i]) {
+            used++;
+            last = i;
+        }
+    }
+    return used;
+}
+
+// Older format: decimal character count, a comma, the pre-order tree and a space
+static bool decode_tree_format(const unsigned char *input, size_t input_size, OutputFile &output, long long int &Total_freq) {
+    const unsigned char *p = input, *end = input + input_size;
+    Total_freq = 0;
+    while (p < end) {
+        char ch = *p++;
+        if (ch == ',') break; 
+        Total_freq *= 10;
+        Total_freq += ch - '0';
+        //coverts sequence of characters into integers
+    }
+
+    Node nodes[2 * Char_size - 1];
+    int node_count = Make_Huffman_tree(p, end, nodes);
+    if (!node_count || p == end) {
+        cerr << "Error: Truncated Huffman tree in input file.\n";
+        return false;
+    }
+    p++; // Skip extra space between compressed data and tree
+
+    if (node_count == 1) //a single distinct character has an empty code
+        return write_repeated(output, nodes[0].character, Total_freq);
+
+    CodeTable codes = {};
+    DecodeTable table;
+    if (!collect_codes(nodes, node_count, codes) || !buildDecodeTable(codes, table)) {
+        cerr << "Error: Invalid Huffman tree in input file.\n";
+        return false;
+    }
+    return decode(p, end - p, output, table, Total_freq);
+}
+
+// Canonical format: fixed size header with the original size and the code lengths
+static bool decode_canonical_format(const unsigned char *input, size_t input_size, OutputFile &output, long long int &Total_freq) {
+    if (input_size < Huf_header_size || input[3] != Huf_version_canonical) {
+        cerr << "Error: Unsupported or truncated .huf header.\n";
+        return false;
+    }
+    Total_freq = load_le64(input + 4);
+
+    uint8_t lengths[Char_size];
+    int last = 0;
+    int used = read_lengths(input + 12, lengths, last);
+    if (Total_freq == 0) return true;
+    if (used == 1) return write_repeated(output, last, Total_freq);
+
+    CodeTable codes;
+    DecodeTable table;
+    canonicalCodes(lengths, codes);
+    if (!buildDecodeTable(codes, table)) {
+        cerr << "Error: Invalid code lengths in input file.\n";
+        return false;
+    }
+    return decode(input + Huf_header_size, input_size - Huf_header_size, output, table, Total_freq);
+}
+
+// Original size of a version 3 message, false if the header does not make sense. Every
+// character takes at least one bit
+static bool dictionary_size(const unsigned char *input, uint64_t input_size, uint64_t &Total_freq) {
+    if (input_size < Huf_file_header_size || memcmp(input, Huf_magic, 3) != 0 || input[3] != Huf_version_dictionary) return false;
+    Total_freq = load_le64(input + 8);
+    return Total_freq <= (input_size - Huf_file_header_size) * 8;
+}
+
+// Dictionary format: the codes of a registered dictionary, the message has no code lengths
+static bool decode_dictionary_format(const unsigned char *input, uint64_t input_size, OutputFile &output, JobProgress *progress,
+                                     JobStats *stats, long long int &Total_freq) {
+    PhaseClock clock(stats);
+    uint64_t total;
+    if (!dictionary_size(input, input_size, total)) {
+        cerr << "Error: Invalid or truncated .huf file.\n";
+        return false;
+    }
+    shared_ptr<const DictionaryTable> dictionary = findDictionary(load_le32(input + 4));
+    if (!dictionary) {
+        cerr << "Error: Dictionary " << load_le32(input + 4) << " is not registered.\n";
+        return false;
+    }
+    Total_freq = total;
+    if (progress && !progress->total) progress->total = total;
+    clock.lap(Phase_header, 0);
+    if (!decode(input + Huf_file_header_size, input_size - Huf_file_header_size, output, dictionary->table, total)) return false;
+    clock.lap(Phase_decode, total);
+    if (stats) {
+        const uint8_t *lengths = dictionary->table.length;
+        stats->add_codes(total, (input_size - Huf_file_header_size) * 8, *max_element(lengths, lengths + Char_size));
+    }
+    if (progress) progress->add(total);
+    return true;
+}
+
+// Decode N code streams of one block in the same loop. Each stream is its own chain of
+// dependent lookups, so the lookups of different streams overlap in the CPU
+template <int N>
+static bool decode_interleaved(const DecodeTable &table, BitReader readers[], unsigned char *out[], unsigned char *end[]) {
+    BitReader reader[N];
+    unsigned char *o[N];
+    for (int s = 0; s < N; s++) {
+        reader[s] = readers[s];
+        o[s] = out[s];
+    }
+    const DecodeEntry *entries = table.entries.data();
+
+    if (table.entries.size() == (1 << Table_bits)) {
+        //same as decode_symbols: one refill serves four lookups, each writing at most 2 bytes.
+        //The loops over the streams are unrolled so every reader stays in registers
+        auto room = [&]() {
+            for (int s = 0; s < N; s++)
+                if (end[s] - o[s] < 8) return false;
+            return true;
+        };
+        while (room()) {
+#pragma GCC unroll 8
+            for (int s = 0; s < N; s++) reader[s].refill();
+#pragma GCC unroll 4
+            for (int k = 0; k < 4; k++)
+#pragma GCC unroll 8
+                for (int s = 0; s < N; s++) {
+                    DecodeEntry entry = entries[reader[s].peek(Table_bits)];
+                    if (!entry.count) return false; //no code starts with these bits
+                    o[s][0] = entry.value & 0xFF;
+                    o[s][1] = entry.value >> 8;
+                    o[s] += entry.count;
+                    reader[s].consume(entry.bits);
                 }
-                pointer = Root; //back to root to start decoding again
-                continue;
-            }
-            if ((bits_8 & (1 << counter))) { //checks if bit is 1 or 0
-                pointer = pointer->right;
-            } else {
-                pointer = pointer->left;
+        }
+    }
+
+    //the rest of every stream one at a time
+    for (int s = 0; s < N; s++)
+        if (!decode_symbols(table, reader[s], o[s], end[s] - o[s]) || reader[s].exhausted()) return false;
+    return true;
+}
+
+// Split a Block_huffman_streams body into its streams and decode them side by side
+static bool decode_streams(const DecodeTable &table, const unsigned char *in, size_t in_size, unsigned char *out, size_t size) {
+    if (in_size < 1) return false;
+    int streams = in[0];
+    if (streams < 2 || streams > Max_streams || in_size < 1 + 4 * (size_t)(streams - 1)) return false;
+    const unsigned char *jump = in + 1, *p = jump + 4 * (streams - 1), *in_end = in + in_size;
+    size_t run = (size + streams - 1) / streams;
+
+    BitReader readers[Max_streams];
+    unsigned char *starts[Max_streams], *ends[Max_streams];
+    for (int k = 0; k < streams; k++) {
+        size_t length = k < streams - 1 ? load_le32(jump + 4 * k) : in_end - p;
+        if (length > (size_t)(in_end - p)) return false;
+        readers[k] = BitReader(p, p + length);
+        p += length;
+        size_t first = min(k * run, size);
+        starts[k] = out + first;
+        ends[k] = out + min(first + run, size);
+    }
+
+    switch (streams) {
+    case 2: return decode_interleaved<2>(table, readers, starts, ends);
+    case 3: return decode_interleaved<3>(table, readers, starts, ends);
+    case 4: return decode_interleaved<4>(table, readers, starts, ends);
+    case 5: return decode_interleaved<5>(table, readers, starts, ends);
+    case 6: return decode_interleaved<6>(table, readers, starts, ends);
+    case 7: return decode_interleaved<7>(table, readers, starts, ends);
+    default: return decode_interleaved<8>(table, readers, starts, ends);
+    }
+}
+
+// Code table of one field of an LZ block. used is the number of codes, a single code
+// takes no bits and is returned in single
+static bool load_lz_table(const unsigned char *packed, DecodeTable &table, int &used, int &single) {
+    uint8_t lengths[Char_size];
+    single = 0;
+    used = read_lengths(packed, lengths, single);
+    if (used < 2) return true;
+    CodeTable codes;
+    canonicalCodes(lengths, codes);
+    return buildDecodeTable(codes, table);
+}
+
+// Read a literal run, match length or distance: its code, then the extra bits
+static inline bool read_value(BitReader &reader, const DecodeTable &table, int used, int single, uint32_t &value) {
+    int code = single;
+    if (used > 1) {
+        DecodeEntry entry;
+        if (table.entries.size() == (1 << Table_bits)) { //no sub-tables, the caller has refilled
+            entry = table.entries[reader.peek(Table_bits)];
+            if (!entry.count) return false;
+        } else if (!lookup(reader, table.entries.data(), entry)) {
+            return false;
+        }
+        code = entry.value & 0xFF;
+        reader.consume(entry.count == 2 ? entry.bits - table.length[entry.value >> 8] : entry.bits);
+    } else if (used == 0) {
+        return false;
+    }
+    if (code > Lz_max_code) return false;
+    int extra;
+    value = lzBase(code, extra);
+    if (extra) {
+        reader.refill();
+        value += reader.peek(extra);
+        reader.consume(extra);
+    }
+    return true;
+}
+
+// Copy length bytes from distance bytes back. Matches far enough back and away from the end
+// of the output go 8 bytes at a time, closer ones repeat their pattern byte by byte
+static inline void copy_match(unsigned char *op, const unsigned char *out_end, size_t distance, size_t length) {
+    const unsigned char *match = op - distance;
+    if (distance >= 8 && (size_t)(out_end - op) >= length + 16) {
+        memcpy(op, match, 8); //most matches are short, two copies without a loop
+        memcpy(op + 8, match + 8, 8);
+        for (size_t k = 16; k < length; k += 8) memcpy(op + k, match + k, 8);
+    } else {
+        for (size_t k = 0; k < length; k++) op[k] = match[k];
+    }
+}
+
+// Decode a Block_lz body: the literals first, then the sequences copy literal runs and matches
+static bool decode_lz_block(const unsigned char *body, size_t body_size, unsigned char *out, size_t size, BlockScratch &scratch,
+                            PhaseClock &clock) {
+    if (body_size < Lz_tables * Huf_lengths_size + 12) return false;
+    int used[Lz_tables], single[Lz_tables];
+    for (int t = 0; t < Lz_tables; t++)
+        if (!load_lz_table(body + t * Huf_lengths_size, scratch.lz_tables[t], used[t], single[t])) return false;
+    clock.lap(Phase_codes, size);
+    const unsigned char *p = body + Lz_tables * Huf_lengths_size, *body_end = body + body_size;
+    uint32_t sequence_count = load_le32(p), literal_count = load_le32(p + 4), literal_bytes = load_le32(p + 8);
+    p += 12;
+    if (literal_count > size || sequence_count > size / Lz_min_match || literal_bytes > (size_t)(body_end - p)) return false;
+
+    //16 spare bytes let short literal runs be copied 16 bytes at a time
+    vector<unsigned char> &literals = scratch.literals;
+    literals.resize(literal_count + 16);
+    if (literal_count > 0) {
+        if (used[0] == 0) return false;
+        if (used[0] == 1) memset(literals.data(), single[0], literal_count);
+        else if (!decode_buffer(scratch.lz_tables[0], p, literal_bytes, literals.data(), literal_count)) return false;
+    }
+    p += literal_bytes;
+
+    BitReader reader(p, body_end);
+    unsigned char *op = out, *out_end = out + size;
+    const unsigned char *lp = literals.data(), *literal_end = lp + literal_count;
+    for (uint32_t i = 0; i < sequence_count; i++) {
+        uint32_t run, length, distance;
+        reader.refill();
+        if (!read_value(reader, scratch.lz_tables[1], used[1], single[1], run)) return false;
+        reader.refill();
+        if (!read_value(reader, scratch.lz_tables[2], used[2], single[2], length)) return false;
+        reader.refill();
+        if (!read_value(reader, scratch.lz_tables[3], used[3], single[3], distance)) return false;
+        uint64_t match_length = (uint64_t)length + Lz_min_match, match_distance = (uint64_t)distance + 1;
+
+        if (run > (size_t)(literal_end - lp) || run > (size_t)(out_end - op)) return false;
+        if ((size_t)(out_end - op) >= run + 16) {
+            for (size_t k = 0; k < run; k += 16) memcpy(op + k, lp + k, 16);
+        } else {
+            memcpy(op, lp, run);
+        }
+        op += run;
+        lp += run;
+        if (match_distance > (size_t)(op - out) || match_length > (size_t)(out_end - op)) return false;
+        copy_match(op, out_end, match_distance, match_length);
+        op += match_length;
+    }
+    //the literals after the last match fill the rest of the block
+    size_t rest = literal_end - lp;
+    if (rest != (size_t)(out_end - op)) return false;
+    memcpy(op, lp, rest);
+    return !reader.exhausted();
+}
+
+// Decode a Block_ans body: normalized frequencies, then the stream
+static bool decode_ans_block(const unsigned char *body, size_t body_size, unsigned char *out, size_t size, BlockScratch &scratch,
+                             PhaseClock &clock, JobStats *stats) {
+    uint16_t norm[Char_size];
+    int table_log;
+    const unsigned char *stream = readNormalized(body, body + body_size, norm, table_log);
+    if (!stream) return false;
+    clock.lap(Phase_header, size);
+    buildAnsDecodeTable(norm, table_log, scratch.ans_table);
+    clock.lap(Phase_codes, size);
+    if (stats) { //the rarest character takes the most bits
+        int longest = 0;
+        for (int c = 0; c < Char_size; c++)
+            if (norm[c]) longest = max(longest, table_log - (31 - __builtin_clz(norm[c])));
+        stats->add_codes(size, (uint64_t)(body + body_size - stream) * 8, longest);
+    }
+    return ansDecode(scratch.ans_table, stream, body + body_size - stream, out, size);
+}
+
+// Decode a Block_huffman or Block_huffman_streams body
+static bool decode_huffman_block(int type, const unsigned char *body, size_t body_size, unsigned char *out, size_t size,
+                                 BlockScratch &scratch, PhaseClock &clock, JobStats *stats) {
+    if (body_size < Huf_lengths_size) return false;
+    uint8_t lengths[Char_size];
+    int last = 0;
+    int used = read_lengths(body, lengths, last);
+    clock.lap(Phase_header, size);
+    if (size == 0) return true;
+    if (used == 0) return false;
+    if (used == 1) { //a single distinct character has no code bits
+        memset(out, last, size);
+        return true;
+    }
+
+    CodeTable codes;
+    DecodeTable &table = scratch.table;
+    canonicalCodes(lengths, codes);
+    if (!buildDecodeTable(codes, table)) return false;
+    clock.lap(Phase_codes, size);
+    if (stats) stats->add_codes(size, (uint64_t)(body_size - Huf_lengths_size) * 8, *max_element(lengths, lengths + Char_size));
+    if (type == Block_huffman_streams)
+        return decode_streams(table, body + Huf_lengths_size, body_size - Huf_lengths_size, out, size);
+    return decode_buffer(table, body + Huf_lengths_size, body_size - Huf_lengths_size, out, size);
+}
+
+// Decode a Block_context body: the map and the tables picked by it, then the streams
+static bool decode_context_block(const unsigned char *body, size_t body_size, unsigned char *out, size_t size, BlockScratch &scratch,
+                                 PhaseClock &clock, JobStats *stats) {
+    if (body_size < 1) return false;
+    int tables = body[0];
+    size_t header = 1 + Huf_lengths_size * (1 + (size_t)tables);
+    if (tables < 1 || tables > Max_context_tables || body_size < header) return false;
+    uint8_t map[Char_size], lengths[Max_context_tables][Char_size];
+    int last = 0;
+    for (int c = 0; c < Char_size; c++) map[c] = (body[1 + c / 2] >> (4 * (c & 1))) & 0x0F;
+    for (int t = 0; t < tables; t++) read_lengths(body + 1 + Huf_lengths_size * (1 + t), lengths[t], last);
+    clock.lap(Phase_header, size);
+    if (!buildContextDecodeTable(map, lengths, tables, scratch.context_table)) return false;
+    clock.lap(Phase_codes, size);
+    if (stats) stats->add_codes(size, (uint64_t)(body_size - header) * 8, *max_element(lengths[0], lengths[tables]));
+    return contextDecode(scratch.context_table, body + header, body_size - header, out, size);
+}
+
+// Decode a Block_tokens body: the tokens and the code lengths of all symbols, then the streams
+static bool decode_token_block(const unsigned char *body, size_t body_size, unsigned char *out, size_t size, BlockScratch &scratch,
+                               PhaseClock &clock, JobStats *stats) {
+    if (body_size < 2) return false;
+    int tokens = body[0] | (body[1] << 8);
+    const int n = 256 + tokens;
+    size_t header = 2 + 2 * (size_t)tokens + (n + 1) / 2;
+    if (tokens > Max_tokens || body_size < header) return false;
+    uint16_t pairs[Max_tokens];
+    uint8_t lengths[Token_alphabet];
+    for (int t = 0; t < tokens; t++) pairs[t] = body[2 + 2 * t] << 8 | body[3 + 2 * t];
+    const unsigned char *packed = body + 2 + 2 * tokens;
+    for (int s = 0; s < n; s++) lengths[s] = (packed[s / 2] >> (4 * (s & 1))) & 0x0F;
+    clock.lap(Phase_header, size);
+    if (!buildTokenDecodeTable(pairs, tokens, lengths, scratch.token_table)) return false;
+    clock.lap(Phase_codes, size);
+    if (stats) stats->add_codes(size, (uint64_t)(body_size - header) * 8, *max_element(lengths, lengths + n));
+    return tokenDecode(scratch.token_table, body + header, body_size - header, out, size);
+}
+
+// Copy out a Block_stored body
+static bool decode_stored_block(const unsigned char *body, size_t body_size, unsigned char *out, size_t size, JobStats *stats) {
+    if (body_size != size) return false;
+    memcpy(out, body, size);
+    if (stats) stats->add_codes(size, (uint64_t)size * 8, 8);
+    return true;
+}
+
+// Decode a block body into size bytes at out, scratch keeps its memory for the next block.
+// A block with a checksum is checked right after decoding, while its output is still in cache
+static bool decode_block(int type, const unsigned char *body, size_t body_size, unsigned char *out, size_t size, BlockScratch &scratch,
+                         JobStats *stats) {
+    PhaseClock clock(stats);
+    bool checksum = type != Block_end && (type & Block_checksum);
+    if (checksum) {
+        if (body_size < Checksum_size) return false;
+        body_size -= Checksum_size;
+        type &= ~Block_checksum;
+    }
+    bool ok;
+    if (type == Block_stored) ok = decode_stored_block(body, body_size, out, size, stats);
+    else if (type == Block_context) ok = decode_context_block(body, body_size, out, size, scratch, clock, stats);
+    else if (type == Block_tokens) ok = decode_token_block(body, body_size, out, size, scratch, clock, stats);
+    else if (type == Block_lz) ok = decode_lz_block(body, body_size, out, size, scratch, clock);
+    else if (type == Block_ans) ok = decode_ans_block(body, body_size, out, size, scratch, clock, stats);
+    else if (type == Block_huffman || type == Block_huffman_streams)
+        ok = decode_huffman_block(type, body, body_size, out, size, scratch, clock, stats);
+    else return false;
+    ok = ok && (!checksum || crc32c(0, out, size) == load_le32(body + body_size));
+    clock.lap(Phase_decode, size);
+    return ok;
+}
+
+bool decodeBlock(int type, const unsigned char *body, size_t body_size, unsigned char *out, size_t size) {
+    BlockScratch scratch;
+    return decode_block(type, body, body_size, out, size, scratch, NULL);
+}
+
+// Block directory of a block format file in memory
+struct BlockDirectory {
+    const unsigned char *input;
+    const unsigned char *entries;
+    uint64_t offset; // file offset of the directory
+    uint64_t count;  // number of blocks
+    uint32_t block_size; // from the file header, every block but the last decodes to exactly this
+
+    uint64_t raw_offset(uint64_t b) const { return load_le64(entries + b * Huf_directory_entry_size); }
+    // The block after the last one is the end marker
+    uint64_t file_offset(uint64_t b) const {
+        return b < count ? load_le64(entries + b * Huf_directory_entry_size + 8) : offset - Huf_block_header_size;
+    }
+    const unsigned char *block(uint64_t b) const { return input + file_offset(b); }
+    uint32_t raw_length(uint64_t b) const { return load_le32(block(b)); }
+
+    // Block b lies between the header and the directory, ends where the next one starts, decodes
+    // to the original offset expected and to a whole block unless it is the last. Its header is
+    // only read once its offset is known to be inside the file
+    bool check(uint64_t b, uint64_t expected) const {
+        uint64_t at = file_offset(b), next = file_offset(b + 1);
+        if (at < Huf_file_header_size || at > offset - Huf_block_header_size || next < at + Huf_block_header_size ||
+            next > offset)
+            return false;
+        uint32_t length = load_le32(input + at);
+        return at + Huf_block_header_size + load_le32(input + at + 4) == next && raw_offset(b) == expected &&
+               length <= block_size && (b + 1 == count || length == block_size);
+    }
+
+    bool decode(uint64_t b, unsigned char *out, BlockScratch &scratch, JobStats *stats = NULL) const {
+        const unsigned char *p = block(b);
+        return decode_block(p[8], p + Huf_block_header_size, load_le32(p + 4), out, load_le32(p), scratch, stats);
+    }
+};
+
+// Find the block directory through the footer, false if the footer does not make sense
+static bool read_directory(const unsigned char *input, uint64_t input_size, BlockDirectory &directory) {
+    if (input_size < Huf_file_header_size + Huf_block_header_size + Huf_footer_size) return false;
+    const unsigned char *footer = input + input_size - Huf_footer_size;
+    if (memcmp(footer + 16, Huf_footer_magic, 4) != 0) {
+        cerr << "Error: Missing block directory.\n";
+        return false;
+    }
+    directory.input = input;
+    directory.block_size = load_le32(input + 4);
+    if (directory.block_size == 0 || directory.block_size > Max_block_size) return false;
+    directory.offset = load_le64(footer);
+    directory.count = load_le64(footer + 8);
+    if (directory.offset < Huf_file_header_size + Huf_block_header_size || directory.offset > input_size - Huf_footer_size)
+        return false;
+    directory.entries = input + directory.offset;
+    return directory.count == (input_size - Huf_footer_size - directory.offset) / Huf_directory_entry_size;
+}
+
+// Check every block and find the original size, which the header leaves unknown for streams
+static bool check_blocks(const BlockDirectory &directory, uint64_t &Total_freq) {
+    uint64_t total = 0;
+    for (uint64_t b = 0; b < directory.count; b++) {
+        if (!directory.check(b, total)) return false;
+        total += directory.raw_length(b);
+    }
+    uint64_t expected = load_le64(directory.input + 8);
+    Total_freq = total;
+    return expected == Huf_unknown_size || expected == total;
+}
+
+// Block format: the directory at the end of the file lists every block, so the blocks are
+// decoded in parallel, straight into the mapped output file or a few per thread at a time.
+// Cancelling stops before the next block and fails
+static bool decode_block_format(const unsigned char *input, uint64_t input_size, OutputFile &output, ThreadPool &pool,
+                                JobProgress *progress, JobStats *stats, long long int &Total_freq) {
+    BlockDirectory directory;
+    uint64_t total;
+    //check every block header before any thread touches the data
+    PhaseClock clock(stats);
+    if (!read_directory(input, input_size, directory) || !check_blocks(directory, total)) return false;
+    clock.lap(Phase_header, 0);
+    Total_freq = total;
+    if (progress && !progress->total) progress->total = total;
+    const uint64_t block_count = directory.count;
+    auto raw_offset = [&](uint64_t b) { return directory.raw_offset(b); };
+    auto raw_length = [&](uint64_t b) { return directory.raw_length(b); };
+    auto decode_one = [&](uint64_t b, unsigned char *out) {
+        if (progress && progress->cancelled()) return false;
+        BlockScratch scratch;
+        if (!directory.decode(b, out, scratch, stats)) {
+            cerr << "Error: Block " << b << " at original offset " << raw_offset(b) << " (file offset "
+                 << directory.file_offset(b) << ") is corrupt.\n";
+            return false;
+        }
+        if (progress) progress->add(raw_length(b));
+        return true;
+    };
+
+    unsigned char *out = output.map(Total_freq);
+    if (out) {
+        vector<char> ok(block_count);
+        pool.parallel_for(block_count, [&](size_t b) { ok[b] = decode_one(b, out + raw_offset(b)); });
+        return find(ok.begin(), ok.end(), 0) == ok.end();
+    }
+
+    const size_t wave = pool.size() * 2;
+    vector<unsigned char> buffer;
+    for (uint64_t first = 0; first < block_count; first += wave) {
+        uint64_t blocks = min<uint64_t>(wave, block_count - first);
+        uint64_t base = raw_offset(first);
+        buffer.resize(raw_offset(first + blocks - 1) + raw_length(first + blocks - 1) - base);
+        vector<char> ok(blocks);
+        pool.parallel_for(blocks, [&](size_t b) { ok[b] = decode_one(first + b, buffer.data() + raw_offset(first + b) - base); });
+        if (find(ok.begin(), ok.end(), 0) != ok.end()) return false;
+        PhaseClock write_clock(stats);
+        if (!output.write(buffer.data(), buffer.size())) return false;
+        write_clock.lap(Phase_decode, 0);
+    }
+    return true;
+}
+
+// Block format read front to back: block headers are followed one after another up to the end
+// marker, a few blocks per thread are decoded together and written before more input is read
+static bool decode_block_stream(int in_fd, OutputFile &output, ThreadPool &pool, JobProgress *progress, JobStats *stats,
+                                uint64_t &Total_freq) {
+    unsigned char header[Huf_file_header_size];
+    if (readFull(in_fd, header, Huf_file_header_size) != Huf_file_header_size ||
+        memcmp(header, Huf_magic, 3) != 0 || header[3] != Huf_version_blocks) {
+        cerr << "Error: Input is not a block .huf stream.\n";
+        return false;
+    }
+    const uint32_t block_size = load_le32(header + 4);
+    const uint64_t expected = load_le64(header + 8);
+    if (block_size == 0 || block_size > Max_block_size) return false;
+    if (progress && expected != Huf_unknown_size && !progress->total) progress->total = expected;
+    //no block can grow by more than its longest codes plus the code lengths
+    const uint64_t max_body = max<uint64_t>(Huf_lengths_size + 1 + 4 * Max_streams, Ans_header_max) +
+                              (uint64_t)block_size * Max_code_length / 8 + Max_streams + Checksum_size + 16;
+
+    struct Pending {
+        vector<unsigned char> body;
+        uint32_t raw_length;
+        int type;
+    };
+    const size_t wave = pool.size() * 2;
+    vector<Pending> blocks(wave);
+    vector<unsigned char> buffer;
+    Total_freq = 0;
+    bool ended = false;
+    while (!ended) {
+        if (progress && progress->cancelled()) return false;
+        //read up to a wave of blocks, every header checked before anything is decoded
+        PhaseClock read_clock(stats);
+        size_t count = 0;
+        uint64_t raw = 0;
+        while (count < wave) {
+            unsigned char block_header[Huf_block_header_size];
+            if (readFull(in_fd, block_header, Huf_block_header_size) != Huf_block_header_size) return false;
+            Pending &block = blocks[count];
+            block.raw_length = load_le32(block_header);
+            uint32_t body_length = load_le32(block_header + 4);
+            block.type = block_header[8];
+            if (block.type == Block_end) {
+                ended = true;
+                break;
             }
-            counter--;
+            if (block.raw_length > block_size || body_length > max_body) return false;
+            block.body.resize(body_length);
+            if (readFull(in_fd, block.body.data(), body_length) != body_length) return false;
+            raw += block.raw_length;
+            count++;
         }
-        if (eof_flag) break;
+
+        read_clock.lap(Phase_header, 0);
+        buffer.resize(raw);
+        vector<uint64_t> offset(count + 1, 0);
+        for (size_t b = 0; b < count; b++) offset[b + 1] = offset[b] + blocks[b].raw_length;
+        vector<char> ok(count);
+        pool.parallel_for(count, [&](size_t b) {
+            BlockScratch scratch;
+            ok[b] = decode_block(blocks[b].type, blocks[b].body.data(), blocks[b].body.size(), buffer.data() + offset[b],
+                                 blocks[b].raw_length, scratch, stats);
+        });
+        for (size_t b = 0; b < count; b++)
+            if (!ok[b]) {
+                cerr << "Error: Block at original offset " << Total_freq + offset[b] << " is corrupt.\n";
+                return false;
+            }
+        PhaseClock write_clock(stats);
+        if (!output.write(buffer.data(), buffer.size())) return false;
+        write_clock.lap(Phase_decode, 0);
+        Total_freq += raw;
+        if (progress) progress->add(raw);
     }
-    output.close();
+    //the directory and footer after the end marker are not needed here
+    return expected == Huf_unknown_size || expected == Total_freq;
 }
 
-// Main function to decompress a file
 bool decompressFile(const string &input_filename, const string &output_filename) {
+    return decompressFile(input_filename, output_filename, DecompressOptions());
+}
+
+bool decompressInto(const unsigned char *input, uint64_t input_size, OutputFile &output, const DecompressOptions &options) {
+    long long int Total_freq;
+    if (input_size < 4 || memcmp(input, Huf_magic, 3) != 0) return false;
+    const uint64_t start_time = options.stats ? nanoseconds_now() : 0;
+    bool success;
+    if (input[3] == Huf_version_dictionary) {
+        success = decode_dictionary_format(input, input_size, output, options.progress, options.stats, Total_freq);
+    } else if (input[3] == Huf_version_blocks) {
+        unique_ptr<ThreadPool> own_pool;
+        if (options.threads > 0) own_pool.reset(new ThreadPool(options.threads));
+        success = decode_block_format(input, input_size, output, own_pool ? *own_pool : ThreadPool::shared(), options.progress,
+                                      options.stats, Total_freq);
+    } else {
+        return false;
+    }
+    if (options.stats) options.stats->wall_nanoseconds += nanoseconds_now() - start_time;
+    return success;
+}
+
+// Main function to decompress a file
+bool decompressFile(const string &input_filename, const string &output_filename, const DecompressOptions &options) {
     if (input_filename.find(".huf") == string::npos) { //checks if the file has correct extension
         cerr << "Error: File does not have a .huf extension.\n";
         return false;
     }
 
-    ifstream input_file(input_filename.c_str(), ios::binary);
-    if (!input_file.good()) {
+    InputFile input_file;
+    if (!input_file.open(input_filename)) {
         cerr << "Error: Could not open input file.\n";
         return false;
     }
 
+    OutputFile output_file;
+    if (!output_file.open(output_filename)) {
+        cerr << "Error: Could not create output file.\n";
+        return false;
+    }
+
     cout << "\nDecompressing the file....";
-    clock_t start_time = clock();
+    auto start_time = chrono::high_resolution_clock::now();
 
-    long long int Total_freq = 0;
-    char ch;
-    while (input_file.get(ch)) {
-        if (ch == ',') break; 
-        Total_freq *= 10;
-        Total_freq += ch - '0';
-        //coverts sequence of characters into integers
+    // Regular files are memory-mapped, anything else is read into memory first
+    vector<unsigned char> copy;
+    const unsigned char *input = input_file.data();
+    uint64_t input_size = input_file.size();
+    if (!input_file.mapped()) {
+        const unsigned char *chunk;
+        size_t n;
+        while ((n = input_file.next(Io_buffer_size, chunk)) > 0)
+            copy.insert(copy.end(), chunk, chunk + n);
+        if (input_file.failed()) {
+            cerr << "Error: Could not read the input file.\n";
+            output_file.close();
+            remove(output_filename.c_str());
+            return false;
+        }
+        input = copy.data();
+        input_size = copy.size();
     }
 
-    Node *Huffman_tree = Make_Huffman_tree(input_file);
-    input_file.get(ch); // Read extra space between compressed data and tree
-
-    // Call the decode function, passing the correct parameters
-    decode(input_file, output_filename, Huffman_tree, Total_freq);
+    // Newer files start with the magic and a version byte, older ones with a digit
+    long long int Total_freq = 0;
+    bool success;
+    if (input_size >= 4 && memcmp(input, Huf_magic, 3) == 0 && input[3] == Huf_version_blocks) {
+        unique_ptr<ThreadPool> own_pool;
+        if (options.threads > 0) own_pool.reset(new ThreadPool(options.threads));
+        success = decode_block_format(input, input_size, output_file, own_pool ? *own_pool : ThreadPool::shared(), options.progress,
+                                      options.stats, Total_freq);
+        if (!success && !(options.progress && options.progress->cancelled())) cerr << "Error: Invalid or truncated .huf file.\n";
+    } else if (input_size >= 4 && memcmp(input, Huf_magic, 3) == 0 && input[3] == Huf_version_dictionary) {
+        success = decode_dictionary_format(input, input_size, output_file, options.progress, options.stats, Total_freq);
+    } else if (input_size >= 4 && memcmp(input, Huf_magic, 3) == 0) {
+        success = decode_canonical_format(input, input_size, output_file, Total_freq);
+    } else {
+        success = decode_tree_format(input, input_size, output_file, Total_freq);
+    }
 
     input_file.close();
+    if (!output_file.close() || !success) {
+        if (options.progress && options.progress->cancelled()) remove(output_filename.c_str()); //no partial output
+        return false;
+    }
 
-    clock_t stop_time = clock();
+    auto stop_time = chrono::high_resolution_clock::now();
+    double seconds = chrono::duration<double>(stop_time - start_time).count();
+    if (options.stats) options.stats->wall_nanoseconds += chrono::duration_cast<chrono::nanoseconds>(stop_time - start_time).count();
 
     cout << "\n\nFile Decompressed Successfully!\n";
-    cout << "Time taken to Decompress:\t" << double(stop_time - start_time) / CLOCKS_PER_SEC << " seconds\n";
+    cout << "Time taken to Decompress:\t" << seconds << " seconds\n";
+    if (seconds > 0)
+        cout << "Decompression speed:\t\t" << Total_freq / seconds / (1024 * 1024) << " MB/s\n";
     return true;
 }
 
+bool decompressStream(int in_fd, int out_fd) {
+    return decompressStream(in_fd, out_fd, DecompressOptions());
+}
+
+// Decompress a block format stream, output starts before the whole input has arrived
+bool decompressStream(int in_fd, int out_fd, const DecompressOptions &options) {
+    OutputFile output_file;
+    output_file.attach(out_fd);
+    unique_ptr<ThreadPool> own_pool;
+    if (options.threads > 0) own_pool.reset(new ThreadPool(options.threads));
+
+    uint64_t Total_freq = 0;
+    const uint64_t start_time = options.stats ? nanoseconds_now() : 0;
+    bool success =
+        decode_block_stream(in_fd, output_file, own_pool ? *own_pool : ThreadPool::shared(), options.progress, options.stats, Total_freq);
+    if (!success && !(options.progress && options.progress->cancelled())) cerr << "Error: Invalid or truncated .huf stream.\n";
+    success = output_file.close() && success;
+    if (options.stats) options.stats->wall_nanoseconds += nanoseconds_now() - start_time;
+    return success;
+}
+
+// Decode only the blocks that overlap [offset, offset + length), found by a binary search of
+// the directory, so the work depends on the length of the range and not on the file size
+bool decompressRange(const string &input_filename, uint64_t offset, uint64_t length, vector<unsigned char> &data) {
+    data.clear();
+    InputFile input_file;
+    if (!input_file.open(input_filename)) {
+        cerr << "Error: Could not open input file.\n";
+        return false;
+    }
+    const unsigned char *input = input_file.data();
+    uint64_t input_size = input_file.size();
+    BlockDirectory directory;
+    if (!input_file.mapped() || input_size < 4 || memcmp(input, Huf_magic, 3) != 0 || input[3] != Huf_version_blocks ||
+        !read_directory(input, input_size, directory)) {
+        cerr << "Error: Not a seekable .huf file.\n";
+        return false;
+    }
+    const uint64_t block_count = directory.count;
+    auto raw_offset = [&](uint64_t b) { return directory.raw_offset(b); };
+    auto raw_length = [&](uint64_t b) { return directory.raw_length(b); };
+    auto invalid = []() {
+        cerr << "Error: Invalid or truncated .huf file.\n";
+        return false;
+    };
+
+    //the range is cut short at the end of the file, like a read(). The last block is checked
+    //before its header gives the original size
+    if (block_count && !directory.check(block_count - 1, raw_offset(block_count - 1))) return invalid();
+    uint64_t total = block_count ? raw_offset(block_count - 1) + raw_length(block_count - 1) : 0;
+    if (offset > total) {
+        cerr << "Error: Offset is past the end of the original file.\n";
+        return false;
+    }
+    length = min(length, total - offset);
+    if (length == 0) return true;
+
+    //last block starting at or before offset, then every block up to the end of the range
+    uint64_t low = 0, high = block_count;
+    while (high - low > 1) {
+        uint64_t middle = low + (high - low) / 2;
+        if (raw_offset(middle) <= offset) low = middle;
+        else high = middle;
+    }
+    uint64_t first = low, last = low;
+    while (last + 1 < block_count && raw_offset(last + 1) < offset + length) last++;
+
+    //only the blocks that are decoded get their headers checked
+    uint64_t base = raw_offset(first), end = base;
+    for (uint64_t b = first; b <= last; b++) {
+        if (!directory.check(b, end)) return invalid();
+        end += raw_length(b);
+    }
+    if (end < offset + length) return invalid();
+
+    vector<unsigned char> buffer(end - base);
+    vector<char> ok(last - first + 1);
+    ThreadPool::shared().parallel_for(ok.size(), [&](size_t i) {
+        BlockScratch scratch;
+        ok[i] = directory.decode(first + i, buffer.data() + raw_offset(first + i) - base, scratch);
+    });
+    for (size_t i = 0; i < ok.size(); i++)
+        if (!ok[i]) {
+            cerr << "Error: Block at original offset " << raw_offset(first + i) << " is corrupt.\n";
+            return false;
+        }
+    data.assign(buffer.begin() + (offset - base), buffer.begin() + (offset - base + length));
+    return true;
+}
+
+// Original size of a compressed buffer, false if it is not a valid block format buffer or
+// dictionary message
+bool Decoder::originalSize(const unsigned char *data, size_t size, uint64_t &original) {
+    BlockDirectory directory;
+    if (size >= 4 && data[3] == Huf_version_dictionary) return dictionary_size(data, size, original);
+    return size >= 4 && memcmp(data, Huf_magic, 3) == 0 && data[3] == Huf_version_blocks &&
+           read_directory(data, size, directory) && check_blocks(directory, original);
+}
+
+// Blocks are decoded one after another on the calling thread with the context's table
+Decoder::Decoder(const DecompressOptions &options) : stats(options.stats) {}
+
+bool Decoder::decompress(const unsigned char *data, size_t size, unsigned char *out, size_t capacity, size_t &written) {
+    written = 0;
+    BlockDirectory directory;
+    uint64_t total;
+    PhaseClock clock(stats);
+    if (size >= 4 && data[3] == Huf_version_dictionary) {
+        if (!dictionary_size(data, size, total) || total > capacity) return false;
+        uint32_t id = load_le32(data + 4);
+        if (!dictionary || dictionary->id != id) dictionary = findDictionary(id);
+        clock.lap(Phase_header, 0);
+        if (!dictionary || !decode_buffer(dictionary->table, data + Huf_file_header_size, size - Huf_file_header_size, out, total))
+            return false;
+        clock.lap(Phase_decode, total);
+        written = total;
+        return true;
+    }
+    if (size < 4 || memcmp(data, Huf_magic, 3) != 0 || data[3] != Huf_version_blocks ||
+        !read_directory(data, size, directory) || !check_blocks(directory, total) || total > capacity)
+        return false;
+    clock.lap(Phase_header, 0);
+    for (uint64_t b = 0; b < directory.count; b++)
+        if (!directory.decode(b, out + directory.raw_offset(b), scratch, stats)) return false;
+    written = total;
+    return true;
+}
+
+bool Decoder::decompress(const unsigned char *data, size_t size, vector<unsigned char> &out) {
+    uint64_t total;
+    size_t written;
+    if (!originalSize(data, size, total)) return false;
+    out.resize(total); //only reallocates when out has never been this large
+    return decompress(data, size, out.data(), out.size(), written);
+}
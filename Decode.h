@@ -1,8 +1,78 @@
 #ifndef DECODE_H
 #define DECODE_H
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
+#include "CodeTable.h"
+#include "Format.h"
+#include "Ans.h"
+#include "Context.h"
+#include "Tokens.h"
+#include "Dictionary.h"
+#include "Progress.h"
+#include "Stats.h"
+
+struct DecompressOptions {
+    int threads = 0; // 0 uses every core
+    JobProgress *progress = nullptr; // optional progress report and cancellation for decompressFile and decompressStream
+    JobStats *stats = nullptr;       // optional time and bytes of every phase, added to what is already there
+};
 
 bool decompressFile(const std::string &input_filename, const std::string &output_filename);
+bool decompressFile(const std::string &input_filename, const std::string &output_filename, const DecompressOptions &options);
+
+// Decompress a block format stream from in_fd to out_fd (standard input and output for pipes),
+// holding only a few blocks per thread in memory at a time. Neither descriptor is closed
+bool decompressStream(int in_fd, int out_fd);
+bool decompressStream(int in_fd, int out_fd, const DecompressOptions &options);
+
+class OutputFile;
+// Decompress a block format .huf file held in memory into output, its blocks on the thread pool.
+// output is not closed
+bool decompressInto(const unsigned char *input, uint64_t input_size, OutputFile &output, const DecompressOptions &options);
+
+// Decompress length bytes of the original file starting at offset into data, decoding only
+// the blocks that cover them. The range stops early at the end of the file. Block format only
+bool decompressRange(const std::string &input_filename, uint64_t offset, uint64_t length, std::vector<unsigned char> &data);
+
+// Decode one block body of the given type into size bytes at out, false if the block is corrupt
+bool decodeBlock(int type, const unsigned char *body, size_t body_size, unsigned char *out, size_t size);
+
+// Scratch memory for decoding blocks, kept from one block to the next
+struct BlockScratch {
+    DecodeTable table;
+    DecodeTable lz_tables[Lz_tables];
+    AnsDecodeTable ans_table;
+    ContextDecodeTable context_table;
+    TokenDecodeTable token_table;
+    std::vector<unsigned char> literals;
+};
+
+// Reusable context decompressing buffers made by Encoder or compressFile. The decode table is
+// kept from one call to the next and the output vector is only grown, so repeated calls
+// allocate nothing. Dictionary messages need their dictionary registered, and decode with its
+// prebuilt table without building one of their own
+class Decoder {
+public:
+    // Only the stats of the options are used, threads and progress do not apply
+    explicit Decoder(const DecompressOptions &options = DecompressOptions());
+
+    // Original size of a compressed buffer, false if the buffer is not valid
+    static bool originalSize(const unsigned char *data, size_t size, uint64_t &original);
+
+    // Decompress into out, false if the data is corrupt or does not fit in capacity.
+    // written is the original size
+    bool decompress(const unsigned char *data, size_t size, unsigned char *out, size_t capacity, size_t &written);
+    // Decompress into out, resized to the original size
+    bool decompress(const unsigned char *data, size_t size, std::vector<unsigned char> &out);
+
+private:
+    BlockScratch scratch;
+    JobStats *stats;
+    std::shared_ptr<const DictionaryTable> dictionary; // last one used, looked up again only when the id changes
+};
 
 #endif
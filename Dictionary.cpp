@@ -0,0 +1,117 @@
+#include <iostream>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include "Dictionary.h"
+#include "FileIO.h"
+#include "Format.h"
+#include "Histogram.h"
+
+using namespace std;
+
+// Code lengths from the counts, plus one for every character so each gets a code
+static void train_lengths(long long int Count[], Dictionary &dictionary) {
+    for (int c = 0; c < Char_size; c++) Count[c]++;
+    limitCodeLengths(Count, Max_code_length, dictionary.lengths);
+    canonicalCodes(dictionary.lengths, dictionary.codes);
+}
+
+void trainDictionary(const unsigned char *samples, size_t size, uint32_t id, Dictionary &dictionary) {
+    long long int Count[Char_size] = {0};
+    countBytes(samples, size, Count);
+    dictionary.id = id;
+    train_lengths(Count, dictionary);
+}
+
+bool trainDictionary(const vector<string> &sample_files, uint32_t id, Dictionary &dictionary) {
+    long long int Count[Char_size] = {0};
+    for (const string &filename : sample_files) {
+        InputFile input;
+        if (!input.open(filename)) {
+            cerr << "Error: Could not open sample file " << filename << "\n";
+            return false;
+        }
+        const unsigned char *chunk;
+        size_t n;
+        while ((n = input.next(Io_buffer_size, chunk)) > 0) countBytes(chunk, n, Count);
+        if (input.failed()) {
+            cerr << "Error: Could not read sample file " << filename << "\n";
+            return false;
+        }
+    }
+    dictionary.id = id;
+    train_lengths(Count, dictionary);
+    return true;
+}
+
+bool saveDictionary(const Dictionary &dictionary, const string &filename) {
+    unsigned char file[Dictionary_file_size];
+    memcpy(file, Dictionary_magic, 4);
+    store_le32(file + 4, dictionary.id);
+    for (int i = 0; i < Huf_lengths_size; i++)
+        file[8 + i] = dictionary.lengths[2 * i] | (dictionary.lengths[2 * i + 1] << 4);
+    OutputFile output;
+    if (!output.open(filename)) {
+        cerr << "Error: Could not create dictionary file at " << filename << "\n";
+        return false;
+    }
+    bool success = output.write(file, Dictionary_file_size);
+    return output.close() && success;
+}
+
+bool loadDictionary(const string &filename, Dictionary &dictionary) {
+    InputFile input;
+    if (!input.open(filename) || !input.mapped()) {
+        cerr << "Error: Could not open dictionary file.\n";
+        return false;
+    }
+    const unsigned char *file = input.data();
+    bool valid = input.size() == Dictionary_file_size && memcmp(file, Dictionary_magic, 4) == 0;
+    for (int c = 0; valid && c < Char_size; c++) {
+        dictionary.lengths[c] = (file[8 + c / 2] >> (4 * (c & 1))) & 0x0F;
+        valid = dictionary.lengths[c] >= 1 && dictionary.lengths[c] <= Max_code_length;
+    }
+    DecodeTable check;
+    if (valid) {
+        dictionary.id = load_le32(file + 4);
+        canonicalCodes(dictionary.lengths, dictionary.codes);
+        valid = buildDecodeTable(dictionary.codes, check);
+    }
+    if (!valid) cerr << "Error: Invalid dictionary file.\n";
+    return valid;
+}
+
+// Registered dictionaries by id, with the code lengths they were registered with
+struct Registry {
+    mutex lock;
+    map<uint32_t, pair<shared_ptr<const DictionaryTable>, vector<uint8_t>>> tables;
+};
+
+static Registry &registry() {
+    static Registry instance;
+    return instance;
+}
+
+bool registerDictionary(const Dictionary &dictionary) {
+    vector<uint8_t> lengths(dictionary.lengths, dictionary.lengths + Char_size);
+    Registry &r = registry();
+    {
+        lock_guard<mutex> guard(r.lock);
+        auto found = r.tables.find(dictionary.id);
+        if (found != r.tables.end()) return found->second.second == lengths;
+    }
+    //the table is built outside the lock, a second registration of the same id keeps the first
+    shared_ptr<DictionaryTable> table = make_shared<DictionaryTable>();
+    table->id = dictionary.id;
+    if (!buildDecodeTable(dictionary.codes, table->table)) return false;
+    lock_guard<mutex> guard(r.lock);
+    auto inserted = r.tables.insert({dictionary.id, {table, lengths}});
+    return inserted.first->second.second == lengths;
+}
+
+shared_ptr<const DictionaryTable> findDictionary(uint32_t id) {
+    Registry &r = registry();
+    lock_guard<mutex> guard(r.lock);
+    auto found = r.tables.find(id);
+    return found == r.tables.end() ? nullptr : found->second.first;
+}
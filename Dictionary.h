@@ -0,0 +1,41 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CodeTable.h"
+
+// Code table trained on sample data and known to both sides, so a message compressed with it
+// carries only the table id instead of its own code lengths, and is coded in a single pass
+// without counting its characters first
+struct Dictionary {
+    uint32_t id;
+    uint8_t lengths[Char_size]; // every character has a code, those missing from the samples a long one
+    CodeTable codes;
+};
+
+// Train from the character counts of the samples. Every character is counted at least once so
+// any message can be coded, at worst Max_code_length bits per character
+void trainDictionary(const unsigned char *samples, size_t size, uint32_t id, Dictionary &dictionary);
+bool trainDictionary(const std::vector<std::string> &sample_files, uint32_t id, Dictionary &dictionary);
+
+// Dictionary file: "HUFC", the id (4) and the code lengths (4 bits each, 128 bytes)
+bool saveDictionary(const Dictionary &dictionary, const std::string &filename);
+bool loadDictionary(const std::string &filename, Dictionary &dictionary);
+
+// Decode table of a registered dictionary, built once when it is registered
+struct DictionaryTable {
+    uint32_t id;
+    DecodeTable table;
+};
+
+// Make a dictionary known to every decoder. False if its id is already taken by different code
+// lengths, so a decoder holding on to a table never sees it change
+bool registerDictionary(const Dictionary &dictionary);
+// Registered dictionary with this id, NULL if there is none
+std::shared_ptr<const DictionaryTable> findDictionary(uint32_t id);
+
+#endif
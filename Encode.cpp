@@ -1,194 +1,802 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
-#include <ctime>
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <memory>
+#include <functional>
+#include <thread>
 #include "Encode.h"
+#include "CodeTable.h"
+#include "BitIO.h"
+#include "Format.h"
+#include "ThreadPool.h"
+#include "FileIO.h"
+#include "Histogram.h"
+#include "Ans.h"
+#include "Dictionary.h"
+#include "Checksum.h"
+#include "Pipeline.h"
 
-using namespace std;
+#define Stored_min_saving 32 // a coded block has to save 1/32 of its size, otherwise it is stored
 
-#define Char_size 256 // ASCII character set only
+using namespace std;
 
-// Structure of Node of Huffman tree
+// Node of the Huffman tree, children are indices into the same array
 struct Node {
-    unsigned char character;
     long long int Freq;
-    Node *left;
-    Node *right;
-
-    Node(unsigned char c, long long int f, Node *l = NULL, Node *r = NULL) 
-        : character(c), Freq(f), left(l), right(r) {}
+    int left, right; // -1 for a leaf
+    unsigned char character;
 };
 
-// Heapify function
-void Mindownheap(vector<Node *> &A, int i, int length) {
-    int least = i;
-    if (2 * i + 1 <= length && A[2 * i + 1]->Freq < A[i]->Freq) {
-        least = 2 * i + 1;
-        if (2 * i + 2 <= length && A[2 * i + 2]->Freq < A[2 * i + 1]->Freq)
-            least = 2 * i + 2;
-    } else if (2 * i + 2 <= length && A[2 * i + 2]->Freq < A[i]->Freq)
-        least = 2 * i + 2;
-
-    if (least != i) {
-        swap(A[i], A[least]);
-        Mindownheap(A, least, length);
-    }
-}
-
-// Extract minimum character from min-heap
-Node *Extract_min(vector<Node *> &A) {
-    if (A.empty()) return NULL;
-    Node *minimum = A[0];
-    A[0] = A.back();
-    A.pop_back();
-    Mindownheap(A, 0, A.size() - 1);
-    return minimum;
-}
-
-// Insert Character in Min-heap
-void Insert_MinHeap(vector<Node *> &A, Node *element) {
-    A.push_back(element);
-    int i = A.size() - 1;
-    while (i > 0 && A[(i - 1) / 2]->Freq > A[i]->Freq) {
-        swap(A[i], A[(i - 1) / 2]);
-        i = (i - 1) / 2;
-    }
-}
-
-// Build min-heap from nodes
-void Build_Minheap(vector<Node *> &A, int length) {
-    for (int i = (length - 1) / 2; i >= 0; i--) {
-        Mindownheap(A, i, length);
-    }
-}
-
-// Store code for each character in a vector
-void store_codes(Node *Root, char single_code[], int index, vector<long long int> &Huffman_codemap) {
-    // single_code[] stores huffmann code path, as we build it
-    //Now we traverse tree
-    if (Root->left) {
-        single_code[index] = '0';
-        store_codes(Root->left, single_code, index + 1, Huffman_codemap);
-    }
-    if (Root->right) {
-        single_code[index] = '1';
-        store_codes(Root->right, single_code, index + 1, Huffman_codemap);
-    }
-    //if we reach a leaf node
-    if (!Root->left && !Root->right) {
-        for (int i = index; i >= 0; i--) {
-            if (i != index) {
-                Huffman_codemap[Root->character] *= 10; //shift to left by one to make room for further encoding
-                Huffman_codemap[Root->character] += single_code[i] - '0'; //character from code[i] converted to integer
-            } else
-                Huffman_codemap[Root->character] = 1; //initialise by 1 meaning the code has been assigned
+// Main Huffman Algorithm on a flat array of nodes (room for 2 * Char_size - 1), nothing is
+// allocated. The leaves are sorted by count and merged nodes are made in increasing order
+// of count, so the two smallest nodes are always at the front of one of the two queues.
+// Children come before their parent and the root is the last node, returns its index
+int Huffman(const long long int Count[], Node nodes[]) {
+    int n = 0;
+    for (int i = 0; i < Char_size; i++)
+        if (Count[i] != 0) nodes[n++] = Node{Count[i], -1, -1, (unsigned char)i};
+    sort(nodes, nodes + n, [](const Node &a, const Node &b) {
+        return a.Freq != b.Freq ? a.Freq < b.Freq : a.character < b.character;
+    });
+    int leaf = 0, merged = n, used = n;
+    auto smallest = [&]() { //front of the leaf queue or of the merged queue
+        return leaf < n && (merged == used || nodes[leaf].Freq <= nodes[merged].Freq) ? leaf++ : merged++;
+    };
+    while (used < 2 * n - 1) {
+        int left = smallest();
+        int right = smallest();
+        nodes[used++] = Node{nodes[left].Freq + nodes[right].Freq, left, right, 0};
+    }
+    return used - 1;
+}
+
+// Store the code length of each character, which is its depth in the tree. Parents come
+// after their children, so one pass down from the root reaches every node
+void store_lengths(const Node nodes[], int root, uint8_t lengths[]) {
+    int depth[2 * Char_size - 1];
+    depth[root] = 0;
+    for (int i = root; i >= 0; i--) {
+        if (nodes[i].left < 0) { //leaf node
+            lengths[nodes[i].character] = min(depth[i], 255);
+            continue;
         }
+        depth[nodes[i].left] = depth[nodes[i].right] = depth[i] + 1;
     }
 }
 
-// Write tree to file
-void store_tree(ofstream &output, Node *Root) {
-    if (!Root->left && !Root->right) {
-        output << '1';
-        output << Root->character;
-     // using '1' for leaf nodes helps program differentiate between leaf nodes and internal nodes   
-    } else {
-        output << '0'; //writes 0 to signify internal nodes
-        store_tree(output, Root->left);
-        store_tree(output, Root->right);
+// Write compressed data to memory, out needs room for size codes of Max_code_length bits
+// plus 8 spare bytes. Returns the end of the data
+unsigned char *Write_compressed(const unsigned char *in, size_t size, const CodeTable &codes, unsigned char *out) {
+    static_assert(4 * Max_code_length <= 56, "four codes must fit between two flushes");
+    BitWriter writer(out);
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) { //four codes fit in the accumulator between flushes
+        writer.put(codes.code[in[i]], codes.length[in[i]]);
+        writer.put(codes.code[in[i + 1]], codes.length[in[i + 1]]);
+        writer.put(codes.code[in[i + 2]], codes.length[in[i + 2]]);
+        writer.put(codes.code[in[i + 3]], codes.length[in[i + 3]]);
+        writer.flush();
+    }
+    for (; i < size; i++) {
+        writer.put(codes.code[in[i]], codes.length[in[i]]);
+        writer.flush();
     }
+    //pad the last byte with 0s on the right
+    return writer.finish();
 }
 
-// Main Huffman Algorithm
-Node *Huffman(long long int Count[]) {
-    vector<Node *> minheap;
+// Choose code lengths no longer than Max_code_length, the Huffman tree gives the optimal
+// ones and package-merge takes over when the tree is too deep. Returns the number of
+// distinct characters
+int code_lengths(long long int Count[], uint8_t lengths[]) {
+    int used = 0, last = 0;
+    for (int i = 0; i < Char_size; i++) {
+        lengths[i] = 0;
+        if (Count[i]) {
+            used++;
+            last = i;
+        }
+    }
+    if (used == 0) return 0;
+    if (used == 1) { //nothing to encode, the decoder repeats the only character
+        lengths[last] = 1;
+        return 1;
+    }
+    Node nodes[2 * Char_size - 1];
+    store_lengths(nodes, Huffman(Count, nodes), lengths);
+    int max_length = 0;
     for (int i = 0; i < Char_size; i++)
-        if (Count[i] != 0)
-            minheap.push_back(new Node(i, Count[i]));
-    Build_Minheap(minheap, minheap.size() - 1);
-    while (minheap.size() != 1) {
-        Node *Z = new Node(-1, 0, Extract_min(minheap), Extract_min(minheap)); //-1 acts as placeholder, and 0 as temporary frequency, and frequency is then set to sum of child frequencies
-        Z->Freq = Z->left->Freq + Z->right->Freq;
-        Insert_MinHeap(minheap, Z);
-    }
-    return minheap[0];
-}
-
-// Write compressed data to file
-void Write_compressed(ifstream &input, ofstream &output, vector<long long int> &Huffman_codemap) {
-    char ch; //temporary variable to store each character
-    unsigned char bits_8 = 0; //8-bit buffer
-    long long int counter = 0; //keeps track of current bits
-    while (input.get(ch)) {
-        long long int temp = Huffman_codemap[static_cast<unsigned char>(ch)];
-        while (temp != 1) { //iterates through each bit
-            bits_8 <<= 1; //shifts left by one position
-            if ((temp % 10) != 0) //checks if last digit is 1
-                bits_8 |= 1; //sets least significant bit as 1
-            temp /= 10; //removes last bit from temp
-            counter++;
-            if (counter == 8) { //full byte hasbeen accumulated
-                output << bits_8; //writes full byte
-                counter = bits_8 = 0; //resets counter and bits
+        max_length = max(max_length, (int)lengths[i]);
+    if (max_length > Max_code_length)
+        limitCodeLengths(Count, Max_code_length, lengths);
+    return used;
+}
+
+// Room needed by encode_block for size bytes of input
+static size_t block_bound(size_t size) {
+    static_assert(Ans_max_table_log <= Max_code_length, "ANS blocks must fit the Huffman bound");
+    return Huf_block_header_size + max<size_t>(Huf_lengths_size + 1 + 4 * Max_streams, Ans_header_max) +
+           size * Max_code_length / 8 + Max_streams + Checksum_size + 16;
+}
+
+// Streams used for a block of size bytes, 1 when the runs would be too short
+static int stream_count(size_t size, int streams) {
+    streams = max(1, min(streams, Max_streams));
+    return size / streams >= Min_stream_length ? streams : 1;
+}
+
+// Write the code and extra bits of a length or distance, no code bits for a table with a
+// single code
+static inline void put_value(BitWriter &writer, const CodeTable &codes, bool coded, uint32_t value) {
+    int extra;
+    int code = lzCode(value, extra);
+    if (coded) writer.put(codes.code[code], codes.length[code]);
+    if (extra) writer.put(value & ((1u << extra) - 1), extra);
+    writer.flush();
+}
+
+// LZ block in scratch.block: the sequences of the match finder, their literal runs, match
+// lengths and distances each with their own code table, and the literals with a fourth one
+static void encode_lz_block(const unsigned char *data, size_t size, int level, LzScratch &scratch, PhaseClock &clock) {
+    scratch.finder.parse(data, size, level);
+    clock.lap(Phase_match, size);
+    const vector<LzSequence> &sequences = scratch.finder.sequences();
+    const vector<unsigned char> &literals = scratch.finder.literals();
+
+    long long int Count[Lz_tables][Char_size] = {{0}};
+    countBytes(literals.data(), literals.size(), Count[0]);
+    int extra;
+    for (const LzSequence &sequence : sequences) {
+        Count[1][lzCode(sequence.literals, extra)]++;
+        Count[2][lzCode(sequence.length - Lz_min_match, extra)]++;
+        Count[3][lzCode(sequence.distance - 1, extra)]++;
+    }
+    uint8_t lengths[Lz_tables][Char_size];
+    CodeTable codes[Lz_tables];
+    bool coded[Lz_tables];
+    for (int t = 0; t < Lz_tables; t++) {
+        coded[t] = code_lengths(Count[t], lengths[t]) > 1;
+        canonicalCodes(lengths[t], codes[t]);
+    }
+
+    //every sequence takes at most 3 codes and 3 times 29 extra bits
+    vector<unsigned char> &block = scratch.block;
+    block.resize(Huf_block_header_size + Lz_tables * Huf_lengths_size + 12 + literals.size() * Max_code_length / 8 +
+                 sequences.size() * 16 + 32);
+    unsigned char *header = block.data();
+    unsigned char *body = header + Huf_block_header_size, *p = body;
+    for (int t = 0; t < Lz_tables; t++)
+        for (int i = 0; i < Huf_lengths_size; i++)
+            *p++ = lengths[t][2 * i] | (lengths[t][2 * i + 1] << 4);
+    store_le32(p, sequences.size());
+    store_le32(p + 4, literals.size());
+    unsigned char *literal_stream = p + 12;
+    p = coded[0] ? Write_compressed(literals.data(), literals.size(), codes[0], literal_stream) : literal_stream;
+    store_le32(literal_stream - 4, p - literal_stream);
+
+    BitWriter writer(p);
+    for (const LzSequence &sequence : sequences) {
+        put_value(writer, codes[1], coded[1], sequence.literals);
+        put_value(writer, codes[2], coded[2], sequence.length - Lz_min_match);
+        put_value(writer, codes[3], coded[3], sequence.distance - 1);
+    }
+    p = writer.finish();
+
+    store_le32(header, size);
+    store_le32(header + 4, p - body);
+    header[8] = Block_lz;
+    block.resize(p - header);
+    clock.lap(Phase_encode, 0); //the block may still lose to plain codes, its bytes are counted there
+}
+
+// Body size of a plain Huffman block with the given code lengths
+static size_t huffman_body_size(const long long int Count[], const uint8_t lengths[], int used, int streams) {
+    if (used < 2) return Huf_lengths_size;
+    uint64_t bits = 0;
+    for (int c = 0; c < Char_size; c++)
+        bits += Count[c] * lengths[c];
+    return Huf_lengths_size + bits / 8 + streams + (streams > 1 ? 1 + 4 * (streams - 1) : 0);
+}
+
+// Body size of an ANS block with the given normalized frequencies
+static size_t ans_body_size(const long long int Count[], const uint16_t norm[], int used) {
+    return 1 + 32 + (used * Ans_table_log + 7) / 8 + ansCost(Count, norm, Ans_table_log) / 8 + 3;
+}
+
+// Order-1 tables of a block in scratch: the contexts clustered into at most max_tables
+// tables and their codes. Returns the body size they would give
+static size_t context_body_size(const unsigned char *data, size_t size, int max_tables, int streams, ContextScratch &scratch,
+                                int &tables, PhaseClock &clock) {
+    tables = clusterContexts(data, size, (size + streams - 1) / streams, max_tables, scratch);
+    clock.lap(Phase_histogram, size);
+    uint64_t bits = 0;
+    for (int k = 0; k < tables; k++) {
+        code_lengths(scratch.cluster[k], scratch.lengths[k]);
+        for (int c = 0; c < Char_size; c++) bits += scratch.cluster[k][c] * scratch.lengths[k][c];
+    }
+    clock.lap(Phase_tree, size);
+    return 1 + Huf_lengths_size * (1 + tables) + 1 + 4 * (streams - 1) + bits / 8 + streams;
+}
+
+// Block_context body at body: table count, map, code lengths, then the streams
+static unsigned char *write_context_body(const unsigned char *data, size_t size, int tables, int streams, ContextScratch &scratch,
+                                         unsigned char *body) {
+    unsigned char *p = body;
+    *p++ = tables;
+    for (int i = 0; i < Huf_lengths_size; i++) *p++ = scratch.map[2 * i] | (scratch.map[2 * i + 1] << 4);
+    for (int k = 0; k < tables; k++) {
+        for (int i = 0; i < Huf_lengths_size; i++) *p++ = scratch.lengths[k][2 * i] | (scratch.lengths[k][2 * i + 1] << 4);
+        canonicalCodes(scratch.lengths[k], scratch.codes[k]);
+    }
+    return contextEncode(data, size, scratch.map, scratch.codes, streams, p);
+}
+
+// Byte pair alphabet of a block in scratch: the tokens and the code lengths of all symbols.
+// Returns the body size they would give, SIZE_MAX when no pair is frequent enough
+static size_t token_body_size(const unsigned char *data, size_t size, int max_tokens, int streams, TokenScratch &scratch,
+                              int &tokens, PhaseClock &clock) {
+    tokens = chooseTokens(data, size, max_tokens, streams, scratch);
+    clock.lap(Phase_histogram, size);
+    if (!tokens) return SIZE_MAX;
+    const int n = 256 + tokens;
+    tokenCodeLengths(n, Token_code_length, scratch);
+    uint64_t bits = 0;
+    for (int s = 0; s < n; s++) bits += scratch.count[s] * scratch.lengths[s];
+    clock.lap(Phase_tree, size);
+    return 2 + 2 * tokens + (n + 1) / 2 + 1 + 4 * (streams - 1) + bits / 8 + streams;
+}
+
+// Block_tokens body at body: token count, tokens, code lengths, then the streams
+static unsigned char *write_token_body(const unsigned char *data, size_t size, int tokens, int streams, TokenScratch &scratch,
+                                       unsigned char *body) {
+    const int n = 256 + tokens;
+    unsigned char *p = body;
+    p[0] = tokens & 0xFF;
+    p[1] = tokens >> 8;
+    p += 2;
+    for (int t = 0; t < tokens; t++) {
+        *p++ = scratch.pairs[t] >> 8;
+        *p++ = scratch.pairs[t] & 0xFF;
+    }
+    for (int s = 0; s < n; s += 2) *p++ = scratch.lengths[s] | (s + 1 < n ? scratch.lengths[s + 1] << 4 : 0);
+    tokenCanonicalCodes(scratch.lengths, n, scratch.code);
+    return tokenEncode(data, size, streams, scratch, p);
+}
+
+// Bytes the characters take at their order-0 entropy, the floor for any code of them
+static double entropy_bytes(const long long int Count[], size_t size) {
+    double bits = 0;
+    for (int c = 0; c < Char_size; c++)
+        if (Count[c]) bits -= Count[c] * log2((double)Count[c] / size);
+    return bits / 8;
+}
+
+// Stored block: the original bytes as they are, for data the codes would not shrink
+static unsigned char *store_block(const unsigned char *data, size_t size, unsigned char *out, PhaseClock &clock, JobStats *stats) {
+    store_le32(out, size);
+    store_le32(out + 4, size);
+    out[8] = Block_stored;
+    memcpy(out + Huf_block_header_size, data, size);
+    if (stats) stats->add_codes(size, (uint64_t)size * 8, 8);
+    clock.lap(Phase_encode, size);
+    return out + Huf_block_header_size + size;
+}
+
+// Write one independently decodable block at out: block header, code lengths and codes,
+// split over several code streams when asked. The ANS backend codes the same frequencies
+// with normalized ones instead, and order-1 tables or the byte pair alphabet replace them
+// where those come out smaller.
+// With an LZ level the block is also LZ coded and the smaller
+// of the two is kept. Blocks that would not save Stored_min_saving are stored instead, and
+// when even the entropy of the counts says so no codes are built at all (LZ may still find
+// repeats, so not with an LZ level). out needs block_bound(size) bytes, returns the end of the block
+static unsigned char *encode_codes(const unsigned char *data, size_t size, const CompressOptions &options, LzScratch &scratch,
+                                   unsigned char *out) {
+    JobStats *stats = options.stats;
+    PhaseClock clock(stats);
+    long long int Count[Char_size] = {0};
+    countBytes(data, size, Count);
+    clock.lap(Phase_histogram, size);
+    const size_t worth = size - size / Stored_min_saving; //a coded body has to be smaller
+    if (options.level == 0 && entropy_bytes(Count, size) >= worth) return store_block(data, size, out, clock, stats);
+
+    // Build length-limited canonical codes from the character frequencies
+    uint8_t lengths[Char_size];
+    CodeTable codes;
+    int used = code_lengths(Count, lengths);
+    clock.lap(Phase_tree, size);
+    canonicalCodes(lengths, codes);
+    clock.lap(Phase_codes, size);
+    int streams = used > 1 ? stream_count(size, options.streams) : 1;
+    size_t body_size = huffman_body_size(Count, lengths, used, streams);
+
+    uint16_t norm[Char_size];
+    bool ans = false;
+    if (options.backend != Backend_huffman && used > 1) {
+        normalizeCounts(Count, Ans_table_log, norm);
+        size_t ans_size = ans_body_size(Count, norm, used);
+        if (options.backend == Backend_ans || ans_size < body_size) {
+            ans = true;
+            body_size = ans_size;
+        }
+        clock.lap(Phase_tree, 0);
+    }
+
+    int context_tables = 0;
+    if (options.contexts > 1 && options.backend != Backend_ans && used > 1) {
+        int tables;
+        size_t context_size = context_body_size(data, size, min(options.contexts, Max_context_tables), streams, scratch.context,
+                                                tables, clock);
+        if (context_size < body_size) {
+            context_tables = tables;
+            ans = false;
+            body_size = context_size;
+        }
+    }
+    int tokens = 0;
+    if (options.tokens > 0 && options.backend != Backend_ans && used > 1) {
+        int chosen;
+        size_t token_size = token_body_size(data, size, options.tokens, streams, scratch.tokens, chosen, clock);
+        if (token_size < body_size) {
+            tokens = chosen;
+            context_tables = 0;
+            ans = false;
+            body_size = token_size;
+        }
+    }
+    const bool store = body_size >= worth;
+
+    if (options.level > 0 && used > 1) {
+        encode_lz_block(data, size, options.level, scratch, clock);
+        if (scratch.block.size() < Huf_block_header_size + (store ? worth : body_size)) {
+            memcpy(out, scratch.block.data(), scratch.block.size());
+            clock.lap(Phase_encode, size);
+            return out + scratch.block.size();
+        }
+    }
+    if (store) return store_block(data, size, out, clock, stats);
+    if (stats && tokens) {
+        uint64_t bits = 0;
+        int longest = 0;
+        for (int s = 0; s < 256 + tokens; s++) {
+            bits += scratch.tokens.count[s] * scratch.tokens.lengths[s];
+            longest = max(longest, (int)scratch.tokens.lengths[s]);
+        }
+        stats->add_codes(size, bits, longest);
+    } else if (stats && context_tables) {
+        uint64_t bits = 0;
+        int longest = 0;
+        for (int k = 0; k < context_tables; k++)
+            for (int c = 0; c < Char_size; c++) {
+                bits += scratch.context.cluster[k][c] * scratch.context.lengths[k][c];
+                longest = max(longest, (int)scratch.context.lengths[k][c]);
             }
+        stats->add_codes(size, bits, longest);
+    } else if (stats) { //bits of the characters under the codes that are used
+        uint64_t bits = 0;
+        int longest = 0;
+        for (int c = 0; c < Char_size; c++) {
+            if (!Count[c]) continue;
+            int length = used < 2 ? 0 : ans ? Ans_table_log - (31 - __builtin_clz(norm[c])) : lengths[c];
+            longest = max(longest, length);
+            if (!ans) bits += Count[c] * length;
+        }
+        stats->add_codes(size, ans ? ansCost(Count, norm, Ans_table_log) : bits, longest);
+    }
+
+    unsigned char *header = out;
+    unsigned char *body = header + Huf_block_header_size;
+    if (tokens) {
+        unsigned char *end = write_token_body(data, size, tokens, streams, scratch.tokens, body);
+        store_le32(header, size);
+        store_le32(header + 4, end - body);
+        header[8] = Block_tokens;
+        clock.lap(Phase_encode, size);
+        return end;
+    }
+    if (context_tables) {
+        unsigned char *end = write_context_body(data, size, context_tables, streams, scratch.context, body);
+        store_le32(header, size);
+        store_le32(header + 4, end - body);
+        header[8] = Block_context;
+        clock.lap(Phase_encode, size);
+        return end;
+    }
+    if (ans) {
+        unsigned char *end = ansEncode(data, size, norm, Ans_table_log, writeNormalized(norm, Ans_table_log, body));
+        store_le32(header, size);
+        store_le32(header + 4, end - body);
+        header[8] = Block_ans;
+        clock.lap(Phase_encode, size);
+        return end;
+    }
+    for (int i = 0; i < Huf_lengths_size; i++)
+        body[i] = lengths[2 * i] | (lengths[2 * i + 1] << 4);
+    unsigned char *end = body + Huf_lengths_size;
+    if (streams > 1) {
+        //stream count and jump table, then the streams back to back
+        *end++ = streams;
+        unsigned char *jump = end;
+        end += 4 * (streams - 1);
+        size_t run = (size + streams - 1) / streams;
+        for (int k = 0; k < streams; k++) {
+            unsigned char *start = end;
+            size_t first = k * run;
+            end = Write_compressed(data + first, min(run, size - first), codes, end);
+            if (k < streams - 1) store_le32(jump + 4 * k, end - start);
         }
+    } else if (used > 1) { //a single character needs no bits at all
+        end = Write_compressed(data, size, codes, end);
     }
-    while (counter != 8) { //pads bits with 0s on right
-        bits_8 <<= 1;
-        counter++;
+
+    store_le32(header, size);
+    store_le32(header + 4, end - body);
+    header[8] = streams > 1 ? Block_huffman_streams : Block_huffman;
+    clock.lap(Phase_encode, size);
+    return end;
+}
+
+// encode_codes, followed by the checksum of the original bytes when asked for. The block was
+// just counted and coded, so it is still in cache
+static unsigned char *encode_block(const unsigned char *data, size_t size, const CompressOptions &options, LzScratch &scratch,
+                                   unsigned char *out) {
+    unsigned char *end = encode_codes(data, size, options, scratch, out);
+    if (!options.checksums) return end;
+    PhaseClock clock(options.stats);
+    store_le32(end, crc32c(0, data, size));
+    clock.lap(Phase_encode, 0);
+    store_le32(out + 4, load_le32(out + 4) + Checksum_size);
+    out[8] |= Block_checksum;
+    return end + Checksum_size;
+}
+
+// Append one independently decodable block: block header, code lengths and codes
+void encodeBlock(const unsigned char *data, size_t size, std::vector<unsigned char> &out, const CompressOptions &options) {
+    LzScratch scratch;
+    size_t start = out.size();
+    out.resize(start + block_bound(size));
+    unsigned char *end = encode_block(data, size, options, scratch, out.data() + start);
+    out.resize(end - out.data());
+}
+
+// Version 3 message: header with the dictionary id, then the dictionary's codes for every
+// character in a single pass, nothing counted. out needs room for size codes of
+// Max_code_length bits plus the header and 8 spare bytes, returns the end of the message
+static unsigned char *encode_dictionary(const unsigned char *data, size_t size, const Dictionary &dictionary, unsigned char *out) {
+    memcpy(out, Huf_magic, 3);
+    out[3] = Huf_version_dictionary;
+    store_le32(out + 4, dictionary.id);
+    store_le64(out + 8, size);
+    return Write_compressed(data, size, dictionary.codes, out + Huf_file_header_size);
+}
+
+// Room needed by encode_dictionary for size bytes of input
+static size_t dictionary_bound(size_t size) {
+    return Huf_file_header_size + size * Max_code_length / 8 + 16;
+}
+
+// Compress a whole mapped input as one dictionary message
+static bool compress_dictionary(InputFile &input_file, OutputFile &output_file, const CompressOptions &options) {
+    if (!input_file.mapped()) {
+        std::cerr << "Error: Dictionary mode needs a regular input file.\n";
+        return false;
     }
-    output << bits_8;
+    JobProgress *progress = options.progress;
+    if (progress && !progress->total) progress->total = input_file.size();
+    JobStats *stats = options.stats;
+    const uint64_t start_time = stats ? nanoseconds_now() : 0;
+    PhaseClock clock(stats);
+    std::vector<unsigned char> out(dictionary_bound(input_file.size()));
+    unsigned char *end = encode_dictionary(input_file.data(), input_file.size(), *options.dictionary, out.data());
+    if (progress) progress->add(input_file.size());
+    bool success = output_file.write(out.data(), end - out.data());
+    clock.lap(Phase_encode, input_file.size());
+    if (stats) stats->wall_nanoseconds += nanoseconds_now() - start_time;
+    return success;
 }
 
-// Compress a file and save as output.huf
-// Modify compressFile to take an output path
-// Compress the file and save as output.huf
 bool compressFile(const std::string &input_filename, const std::string &output_filename) {
-    std::vector<long long int> Huffman_codemap(Char_size, 0);
-    long long int Count[Char_size] = {0};
+    return compressFile(input_filename, output_filename, CompressOptions());
+}
 
-    // Open the input file in binary mode
-    std::ifstream input_file(input_filename, std::ios::binary);
-    if (!input_file.good()) {
-        std::cerr << "Error: Could not open input file.\n";
-        return false;
+// A wave of blocks on its way from the input to the output
+struct Batch {
+    const unsigned char *in = NULL; // its input, in the mapping or in buffer
+    size_t size = 0;                // input bytes, 0 once the input has ended
+    std::vector<unsigned char> buffer;
+    std::vector<std::vector<unsigned char>> encoded; // every block, kept from one wave to the next
+};
+
+// Next want bytes of input into batch, straight from the mapping when there is one
+static void read_batch(InputFile &input_file, Batch &batch, size_t want) {
+    if (input_file.mapped()) {
+        batch.size = input_file.next(want, batch.in);
+        return;
     }
+    batch.buffer.resize(want);
+    batch.size = input_file.read(batch.buffer.data(), want);
+    batch.in = batch.buffer.data();
+}
 
-    // Count the frequency of each character in the input file
-    char ch;
-    while (input_file.get(ch)) {
-        Count[static_cast<unsigned char>(ch)]++;
+// Read, encode and write batches at the same time: a reader thread fills them (or faults in
+// their pages of the mapping), the calling thread encodes them on the thread pool and a
+// writer thread writes them out, then hands them back to the reader. The stages pass batches
+// through lock-free queues, each waiting only when the stage before it is behind, so the
+// time taken nears the slowest stage rather than the sum of all three. False when encode
+// reports the job cancelled
+static bool run_pipeline(InputFile &input_file, size_t wave, size_t want, const CompressOptions &options,
+                         const std::function<bool(Batch &)> &encode, const std::function<void(const Batch &)> &write) {
+    const int depth = options.pipeline_depth;
+    std::vector<Batch> batches(depth);
+    SpscQueue<Batch *> empty(depth), filled(depth), encoded(depth);
+    for (Batch &batch : batches) {
+        batch.encoded.resize(wave);
+        empty.push(&batch);
     }
-    input_file.clear();  // Reset file pointer to beginning
-    input_file.seekg(0);
+    std::atomic<bool> stop{false};
+    uint64_t stalled[Stage_count] = {0};
+    int peak[Stage_count] = {0};
 
-    // Create the Huffman tree based on the character frequencies
-    Node *tree = Huffman(Count);
+    std::thread reader([&] {
+        Batch *batch;
+        do {
+            peak[Stage_read] = max<int>(peak[Stage_read], empty.size());
+            if (!empty.pop_wait(batch, stop, stalled[Stage_read])) return;
+            read_batch(input_file, *batch, want);
+            input_file.prefetch(batch->in, batch->size);
+            filled.push(batch); //never full, there are only depth batches
+        } while (batch->size > 0);
+    });
+    std::thread writer([&] {
+        Batch *batch;
+        while (true) {
+            peak[Stage_write] = max<int>(peak[Stage_write], encoded.size());
+            if (!encoded.pop_wait(batch, stop, stalled[Stage_write]) || batch->size == 0) return;
+            write(*batch);
+            empty.push(batch);
+        }
+    });
 
-    // Open the output file in binary mode
-    std::ofstream output_file(output_filename, std::ios::binary);
-    if (!output_file.good()) {
-        std::cerr << "Error: Could not create output file at " << output_filename << "\n";
+    bool success = true, last;
+    Batch *batch;
+    do {
+        peak[Stage_encode] = max<int>(peak[Stage_encode], filled.size());
+        filled.pop_wait(batch, stop, stalled[Stage_encode]);
+        last = batch->size == 0; //once pushed on, the batch may already be back with the reader
+        if (!last && !encode(*batch)) {
+            success = false;
+            stop = true;
+            break;
+        }
+        encoded.push(batch);
+    } while (!last);
+    reader.join();
+    writer.join();
+    if (options.stats)
+        for (int stage = 0; stage < Stage_count; stage++) options.stats->add_stall(stage, stalled[stage], peak[stage]);
+    return success;
+}
+
+// Compress the input in independent blocks, several blocks at a time on the thread pool,
+// appended to the output as one .huf file. When seekable is false the original size is left
+// unknown if it cannot be told up front. Cancelling stops before the next block and fails.
+// Neither file is closed
+static bool compress_blocks(InputFile &input_file, OutputFile &output_file, const CompressOptions &options, bool seekable) {
+    JobProgress *progress = options.progress;
+    JobStats *stats = options.stats;
+    const uint64_t start_time = stats ? nanoseconds_now() : 0;
+    const uint64_t start = output_file.position(); //offsets in the file are relative to its header
+    if (progress && input_file.mapped() && !progress->total) progress->total = input_file.size();
+    std::unique_ptr<ThreadPool> own_pool;
+    if (options.threads > 0) own_pool.reset(new ThreadPool(options.threads));
+    ThreadPool &pool = own_pool ? *own_pool : ThreadPool::shared();
+
+    // Without a mapping the original size is patched in once the whole input has been read,
+    // or stays unknown when the output cannot be rewritten
+    unsigned char header[Huf_file_header_size];
+    memcpy(header, Huf_magic, 3);
+    header[3] = Huf_version_blocks;
+    store_le32(header + 4, options.block_size);
+    store_le64(header + 8, input_file.mapped() ? input_file.size() : Huf_unknown_size);
+    output_file.write(header, Huf_file_header_size);
+
+    // Blocks are taken a few per thread at a time, straight from the mapping when there is one.
+    // Their boundaries only depend on the block size so the output is the same for any number
+    // of threads
+    const size_t block_size = options.block_size;
+    const size_t wave = pool.size() * 2;
+    std::vector<LzScratch> scratch(wave); //one per block of a wave, untouched without an LZ level
+    std::vector<unsigned char> directory;
+    uint64_t Total_freq = 0, file_offset = Huf_file_header_size, block_count = 0;
+
+    auto encode = [&](Batch &batch) {
+        size_t blocks = (batch.size + block_size - 1) / block_size;
+        pool.parallel_for(blocks, [&](size_t b) {
+            if (progress && progress->cancelled()) return;
+            size_t length = std::min(block_size, batch.size - b * block_size);
+            std::vector<unsigned char> &out = batch.encoded[b];
+            out.resize(block_bound(length));
+            unsigned char *end = encode_block(batch.in + b * block_size, length, options, scratch[b], out.data());
+            out.resize(end - out.data());
+            if (progress) progress->add(length);
+        });
+        return !(progress && progress->cancelled());
+    };
+    auto write = [&](const Batch &batch) {
+        PhaseClock clock(stats);
+        size_t blocks = (batch.size + block_size - 1) / block_size;
+        for (size_t b = 0; b < blocks; b++) {
+            unsigned char entry[Huf_directory_entry_size];
+            store_le64(entry, Total_freq + b * block_size);
+            store_le64(entry + 8, file_offset);
+            directory.insert(directory.end(), entry, entry + Huf_directory_entry_size);
+            output_file.write(batch.encoded[b].data(), batch.encoded[b].size());
+            file_offset += batch.encoded[b].size();
+        }
+        clock.lap(Phase_encode, 0);
+        Total_freq += batch.size;
+        block_count += blocks;
+    };
+
+    //an input that fits one wave has nothing to overlap
+    if (options.pipeline_depth > 1 && !(input_file.mapped() && input_file.size() <= wave * block_size)) {
+        if (!run_pipeline(input_file, wave, wave * block_size, options, encode, write)) return false;
+    } else {
+        Batch batch;
+        batch.encoded.resize(wave);
+        while (read_batch(input_file, batch, wave * block_size), batch.size > 0) {
+            if (!encode(batch)) return false;
+            write(batch);
+        }
+    }
+
+    //a read error looks like the end of the input, the footer would make a shorter file look whole
+    if (input_file.failed()) {
+        std::cerr << "Error: Could not read the input.\n";
         return false;
     }
 
-    // Store the frequency and the Huffman tree structure
-    output_file << tree->Freq << ',';
-    store_tree(output_file, tree);
-    output_file << ' ';
+    // End marker, block directory and footer
+    unsigned char end_marker[Huf_block_header_size] = {0};
+    end_marker[8] = Block_end;
+    output_file.write(end_marker, Huf_block_header_size);
+    output_file.write(directory.data(), directory.size());
+    unsigned char footer[Huf_footer_size] = {0};
+    store_le64(footer, file_offset + Huf_block_header_size);
+    store_le64(footer + 8, block_count);
+    memcpy(footer + 16, Huf_footer_magic, 4);
+    output_file.write(footer, Huf_footer_size);
 
-    // Store the Huffman codes for each character
-    char single_code[16];
-    store_codes(tree, single_code, 0, Huffman_codemap);
+    if (!input_file.mapped() && seekable) {
+        store_le64(header + 8, Total_freq);
+        output_file.write_at(start, header, Huf_file_header_size);
+    }
+    if (stats) stats->wall_nanoseconds += nanoseconds_now() - start_time;
+    return true;
+}
+
+static bool valid_block_size(const CompressOptions &options) {
+    if (options.block_size == 0 || options.block_size > Max_block_size) {
+        std::cerr << "Error: Block size must be between 1 byte and 1 GB.\n";
+        return false;
+    }
+    return true;
+}
+
+bool compressInto(InputFile &input_file, OutputFile &output_file, const CompressOptions &options) {
+    if (options.dictionary) return compress_dictionary(input_file, output_file, options);
+    return valid_block_size(options) && compress_blocks(input_file, output_file, options, true);
+}
 
-    // Write the compressed data to the output file
-    Write_compressed(input_file, output_file, Huffman_codemap);
+// Compress a file, memory-mapped when possible and written through a large buffer
+bool compressFile(const std::string &input_filename, const std::string &output_filename, const CompressOptions &options) {
+    if (!valid_block_size(options)) return false;
+
+    // Open the input file, memory-mapped when possible
+    InputFile input_file;
+    if (!input_file.open(input_filename)) {
+        std::cerr << "Error: Could not open input file.\n";
+        return false;
+    }
+
+    // Open the output file, written through a large buffer
+    OutputFile output_file;
+    if (!output_file.open(output_filename)) {
+        std::cerr << "Error: Could not create output file at " << output_filename << "\n";
+        return false;
+    }
+    bool success = options.dictionary ? compress_dictionary(input_file, output_file, options)
+                                      : compress_blocks(input_file, output_file, options, true);
 
     // Close both files
+    bool read_failed = input_file.failed();
     input_file.close();
-    output_file.close();
+    success = output_file.close() && success;
+    if (!success && (read_failed || (options.progress && options.progress->cancelled())))
+        remove(output_filename.c_str()); //no partial output
+    return success;
+}
+
+bool compressStream(int in_fd, int out_fd) {
+    return compressStream(in_fd, out_fd, CompressOptions());
+}
 
+// Compress a stream as it arrives, blocks are written out as soon as they are encoded
+bool compressStream(int in_fd, int out_fd, const CompressOptions &options) {
+    if (!valid_block_size(options)) return false;
+    if (options.dictionary) {
+        std::cerr << "Error: Dictionary mode needs the whole input up front.\n";
+        return false;
+    }
+    InputFile input_file;
+    OutputFile output_file;
+    input_file.attach(in_fd);
+    output_file.attach(out_fd);
+    bool success = compress_blocks(input_file, output_file, options, false);
+    return output_file.close() && success;
+}
+
+Encoder::Encoder(const CompressOptions &options) : options(options) {}
+
+size_t Encoder::bound(size_t size) const {
+    if (options.dictionary) return dictionary_bound(size);
+    const size_t block_size = max<size_t>(options.block_size, 1);
+    size_t blocks = (size + block_size - 1) / block_size;
+    return Huf_file_header_size + size * Max_code_length / 8 + blocks * (block_bound(0) + Huf_directory_entry_size) +
+           Huf_block_header_size + Huf_footer_size;
+}
+
+// Same layout as compressFile, blocks encoded one after another on the calling thread.
+// A dictionary message is written in one pass without blocks
+bool Encoder::compress(const unsigned char *data, size_t size, unsigned char *out, size_t capacity, size_t &written) {
+    written = 0;
+    if (options.dictionary) {
+        if (capacity < dictionary_bound(size)) return false;
+        written = encode_dictionary(data, size, *options.dictionary, out) - out;
+        return true;
+    }
+    const size_t block_size = options.block_size;
+    if (block_size == 0 || block_size > Max_block_size || capacity < bound(size)) return false;
+    unsigned char *p = out;
+    memcpy(p, Huf_magic, 3);
+    p[3] = Huf_version_blocks;
+    store_le32(p + 4, block_size);
+    store_le64(p + 8, size);
+    p += Huf_file_header_size;
+
+    block_offsets.clear(); //keeps its capacity from earlier calls
+    for (size_t at = 0; at < size; at += block_size) {
+        block_offsets.push_back(p - out);
+        p = encode_block(data + at, std::min(block_size, size - at), options, lz, p);
+    }
+
+    memset(p, 0, Huf_block_header_size);
+    p[8] = Block_end;
+    p += Huf_block_header_size;
+    uint64_t directory_offset = p - out;
+    for (size_t b = 0; b < block_offsets.size(); b++) {
+        store_le64(p, b * block_size);
+        store_le64(p + 8, block_offsets[b]);
+        p += Huf_directory_entry_size;
+    }
+    memset(p, 0, Huf_footer_size);
+    store_le64(p, directory_offset);
+    store_le64(p + 8, block_offsets.size());
+    memcpy(p + 16, Huf_footer_magic, 4);
+    p += Huf_footer_size;
+    written = p - out;
     return true;
 }
+
+bool Encoder::compress(const unsigned char *data, size_t size, std::vector<unsigned char> &out) {
+    size_t written;
+    out.resize(bound(size)); //only reallocates when out has never been this large
+    bool success = compress(data, size, out.data(), out.size(), written);
+    out.resize(written);
+    return success;
+}
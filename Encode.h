@@ -1,7 +1,87 @@
 #ifndef ENCODE_H
 #define ENCODE_H
 
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Context.h"
+#include "Lz.h"
+#include "Tokens.h"
+#include "Progress.h"
+#include "Stats.h"
+
+#define Backend_huffman 0
+#define Backend_ans 1
+#define Backend_auto 2 // whichever of the two comes out smaller, block by block
+
+struct Dictionary;
+
+struct CompressOptions {
+    size_t block_size = 1 << 20; // bytes of input per independent block
+    int threads = 0;             // 0 uses every core
+    int streams = 4;             // code streams per block decoded side by side, 1 to 8
+    int level = 0;               // LZ match finding effort, 0 for Huffman codes only, 1 (fast) to 9 (small)
+    int backend = Backend_huffman; // entropy coder of the characters: Backend_huffman, Backend_ans or Backend_auto
+    int contexts = 0;            // order-1 mode: up to this many code tables (2 to 16) picked by the previous byte,
+                                 // used on the blocks where they come out smaller. 0 for one table per block
+    int tokens = 0;              // byte pair alphabet: up to this many frequent pairs (at most 3840) become symbols
+                                 // of their own, used on the blocks where that comes out smaller
+    bool checksums = false;      // store a CRC32C of every block, checked whenever the block is decoded
+    int pipeline_depth = 3;      // batches of blocks in flight between the reader, the encoders and the writer,
+                                 // 1 reads, encodes and writes in turn on the calling thread
+    JobProgress *progress = nullptr; // optional progress report and cancellation for compressFile and compressStream
+    JobStats *stats = nullptr;       // optional time and bytes of every phase, added to what is already there
+    const Dictionary *dictionary = nullptr; // trained code table: the output is a single version 3 message
+                                            // carrying its id, block size and the options above do not apply
+};
+
+// Scratch memory of the LZ stage, the order-1 tables and the byte pair alphabet, kept from
+// one block to the next
+struct LzScratch {
+    MatchFinder finder;
+    std::vector<unsigned char> block; // LZ encoding of the block, used when it is the smaller one
+    ContextScratch context;
+    TokenScratch tokens;
+};
 
 bool compressFile(const std::string &input_filename, const std::string &output_filename);
+bool compressFile(const std::string &input_filename, const std::string &output_filename, const CompressOptions &options);
+// Compress everything read from in_fd to out_fd (standard input and output for pipes),
+// holding only a few blocks per thread in memory at a time. Neither descriptor is closed.
+// Dictionary mode needs the whole input up front and is refused here
+bool compressStream(int in_fd, int out_fd);
+bool compressStream(int in_fd, int out_fd, const CompressOptions &options);
+
+class InputFile;
+class OutputFile;
+// Append everything input_file delivers to output_file as one complete .huf file, its blocks
+// on the thread pool, offsets counted from where it starts. Neither file is closed
+bool compressInto(InputFile &input_file, OutputFile &output_file, const CompressOptions &options);
+
+// Append one independently decodable block (block header and body) for size bytes of data
+void encodeBlock(const unsigned char *data, size_t size, std::vector<unsigned char> &out,
+                 const CompressOptions &options = CompressOptions());
+
+// Reusable context compressing buffers in memory to the same format as compressFile.
+// Scratch memory is kept from one call to the next and the output vector is only grown,
+// so repeated calls on similar sizes allocate nothing
+class Encoder {
+public:
+    explicit Encoder(const CompressOptions &options = CompressOptions());
+
+    // Largest compressed size of size bytes of input
+    size_t bound(size_t size) const;
+
+    // Compress into out, false if capacity is below bound(size). written is the compressed size
+    bool compress(const unsigned char *data, size_t size, unsigned char *out, size_t capacity, size_t &written);
+    // Compress into out, resized to the compressed size
+    bool compress(const unsigned char *data, size_t size, std::vector<unsigned char> &out);
+
+private:
+    CompressOptions options;
+    std::vector<uint64_t> block_offsets; // file offset of every block, for the directory
+    LzScratch lz;
+};
 
 #endif
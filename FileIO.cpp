@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "FileIO.h"
+
+using namespace std;
+
+static unsigned char empty_file[1]; // data() of a mapped empty file
+
+static unsigned char *aligned_buffer(size_t size) {
+    void *p = NULL;
+    if (posix_memalign(&p, 4096, size) != 0) return NULL;
+    return (unsigned char *)p;
+}
+
+InputFile::InputFile()
+    : fd(-1), owned(false), map_data(NULL), map_size(0), position(0), buffer(NULL), buffer_size(0), read_failed(false) {}
+
+InputFile::~InputFile() {
+    close();
+}
+
+bool InputFile::open(const string &path) {
+    close();
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    owned = true;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+        if (info.st_size == 0) {
+            map_data = empty_file;
+            return true;
+        }
+        void *p = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, info.st_size, MADV_SEQUENTIAL);
+            map_data = (unsigned char *)p;
+            map_size = info.st_size;
+        }
+    }
+    return true;
+}
+
+void InputFile::attach(int descriptor) {
+    close();
+    fd = descriptor; //never mapped, streams are read in chunks
+}
+
+void InputFile::close() {
+    if (map_data && map_data != empty_file) munmap(map_data, map_size);
+    if (fd >= 0 && owned) ::close(fd);
+    free(buffer);
+    fd = -1;
+    owned = false;
+    map_data = NULL;
+    map_size = position = 0;
+    buffer = NULL;
+    buffer_size = 0;
+    read_failed = false;
+}
+
+size_t InputFile::next(size_t want, const unsigned char *&chunk) {
+    if (mapped()) {
+        size_t n = min<uint64_t>(want, map_size - position);
+        chunk = map_data + position;
+        position += n;
+        return n;
+    }
+
+    if (buffer_size < want) {
+        free(buffer);
+        buffer_size = max<size_t>(want, Io_buffer_size);
+        buffer = aligned_buffer(buffer_size);
+        if (!buffer) {
+            buffer_size = 0;
+            read_failed = true;
+            return 0;
+        }
+    }
+    size_t n = readFull(fd, buffer, want, &read_failed);
+    chunk = buffer;
+    position += n;
+    return n;
+}
+
+size_t InputFile::read(unsigned char *into, size_t want) {
+    if (mapped()) {
+        const unsigned char *chunk;
+        size_t n = next(want, chunk);
+        memcpy(into, chunk, n);
+        return n;
+    }
+    size_t n = readFull(fd, into, want, &read_failed);
+    position += n;
+    return n;
+}
+
+void InputFile::prefetch(const unsigned char *chunk, size_t size) const {
+    if (!mapped() || size == 0) return;
+    const uintptr_t page = 4096;
+    uintptr_t start = (uintptr_t)chunk & ~(page - 1); //madvise wants a page aligned address
+    madvise((void *)start, (uintptr_t)chunk + size - start, MADV_WILLNEED);
+    volatile unsigned char sink = 0;
+    for (size_t i = 0; i < size; i += page) sink = sink + chunk[i];
+}
+
+OutputFile::OutputFile() : fd(-1), owned(false), map_data(NULL), map_size(0), buffer(NULL), buffered(0), written(0), failed(false) {}
+
+OutputFile::~OutputFile() {
+    close();
+}
+
+bool OutputFile::open(const string &path) {
+    close();
+    failed = false;
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    owned = fd >= 0;
+    return owned;
+}
+
+void OutputFile::attach(int descriptor) {
+    close();
+    failed = false;
+    fd = descriptor;
+}
+
+size_t readFull(int fd, void *data, size_t size, bool *failed) {
+    unsigned char *p = (unsigned char *)data;
+    size_t n = 0;
+    while (n < size) { //pipes hand out whatever is ready, keep reading until the chunk is full
+        ssize_t got = read(fd, p + n, size - n);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0 && failed) *failed = true;
+        if (got <= 0) break;
+        n += got;
+    }
+    return n;
+}
+
+bool writeFull(int fd, const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char *)data;
+    while (size > 0) {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool OutputFile::flush() {
+    if (buffered && !writeFull(fd, buffer, buffered)) failed = true;
+    written += buffered;
+    buffered = 0;
+    return !failed;
+}
+
+bool OutputFile::write(const void *data, size_t size) {
+    if (fd < 0 || map_data || failed) return false;
+    const unsigned char *p = (const unsigned char *)data;
+    if (size >= Io_buffer_size) { //large writes skip the buffer
+        if (!flush() || !writeFull(fd, p, size)) {
+            failed = true;
+            return false;
+        }
+        written += size;
+        return true;
+    }
+    if (!buffer) buffer = aligned_buffer(Io_buffer_size);
+    if (!buffer) {
+        failed = true;
+        return false;
+    }
+    while (size > 0) {
+        size_t n = min(size, (size_t)Io_buffer_size - buffered);
+        memcpy(buffer + buffered, p, n);
+        buffered += n;
+        p += n;
+        size -= n;
+        if (buffered == Io_buffer_size && !flush()) return false;
+    }
+    return true;
+}
+
+bool OutputFile::write_at(uint64_t offset, const void *data, size_t size) {
+    if (fd < 0 || failed || !flush()) return false;
+    if (pwrite(fd, data, size, offset) != (ssize_t)size) failed = true;
+    return !failed;
+}
+
+unsigned char *OutputFile::map(uint64_t size) {
+    if (fd < 0 || map_data || position() != 0) return NULL;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || ftruncate(fd, size) != 0) return NULL;
+    if (size == 0) return map_data = empty_file;
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        if (ftruncate(fd, 0) != 0) failed = true;
+        return NULL;
+    }
+    map_data = (unsigned char *)p;
+    map_size = size;
+    return map_data;
+}
+
+bool OutputFile::close() {
+    if (fd < 0) return !failed;
+    if (map_data) {
+        if (map_data != empty_file) munmap(map_data, map_size);
+    } else {
+        flush();
+    }
+    if (owned && ::close(fd) != 0) failed = true;
+    free(buffer);
+    fd = -1;
+    owned = false;
+    map_data = NULL;
+    map_size = buffered = written = 0;
+    buffer = NULL;
+    return !failed;
+}
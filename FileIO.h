@@ -0,0 +1,95 @@
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define Io_buffer_size (4 << 20) // read and write size when a file is not memory-mapped
+
+// Read until size bytes have arrived or the input ends, returns the bytes read. A read error
+// also ends it early and sets *failed when given, so it can be told apart from the end
+size_t readFull(int fd, void *data, size_t size, bool *failed = NULL);
+// Write everything, pipes may take less than asked for at a time
+bool writeFull(int fd, const void *data, size_t size);
+
+// Input file, memory-mapped when it is a regular file. Pipes and other files that cannot
+// be mapped are read in large aligned chunks instead
+class InputFile {
+public:
+    InputFile();
+    ~InputFile();
+
+    bool open(const std::string &path);
+    // Read from a descriptor the caller keeps open, such as standard input
+    void attach(int descriptor);
+    void close();
+
+    bool mapped() const { return map_data != NULL; }
+    // The whole file, only when mapped()
+    const unsigned char *data() const { return map_data; }
+    uint64_t size() const { return map_size; }
+
+    // Next up to want bytes of the file, fewer only at the end or after a read error (then
+    // failed()). chunk points into the mapping or into an internal buffer that stays valid
+    // until the next call
+    size_t next(size_t want, const unsigned char *&chunk);
+    // Next up to want bytes copied to into, which the caller keeps as long as it likes.
+    // Without a mapping they are read straight into it
+    size_t read(unsigned char *into, size_t want);
+    // Ask for the pages of a chunk of the mapping and fault them in, so the wait for the disk
+    // happens on the calling thread instead of on whoever reads the chunk next
+    void prefetch(const unsigned char *chunk, size_t size) const;
+    // A read failed, so the input seen so far may be cut short
+    bool failed() const { return read_failed; }
+
+private:
+    InputFile(const InputFile &);
+    InputFile &operator=(const InputFile &);
+
+    int fd;
+    bool owned; // fd is closed by close()
+    unsigned char *map_data;
+    uint64_t map_size;
+    uint64_t position; // bytes handed out by next()
+    unsigned char *buffer;
+    size_t buffer_size;
+    bool read_failed;
+};
+
+// Output file written through a large buffer, or mapped at its final size when that is known
+class OutputFile {
+public:
+    OutputFile();
+    ~OutputFile();
+
+    bool open(const std::string &path);
+    // Write to a descriptor the caller keeps open, such as standard output
+    void attach(int descriptor);
+    bool close();
+
+    bool write(const void *data, size_t size);
+    // Overwrite bytes already written, for headers patched at the end
+    bool write_at(uint64_t offset, const void *data, size_t size);
+    // Size the file and map it for writing in place, NULL if that is not possible (pipes).
+    // Only before anything has been written
+    unsigned char *map(uint64_t size);
+
+    uint64_t position() const { return written + buffered; }
+
+private:
+    OutputFile(const OutputFile &);
+    OutputFile &operator=(const OutputFile &);
+    bool flush();
+
+    int fd;
+    bool owned;
+    unsigned char *map_data;
+    uint64_t map_size;
+    unsigned char *buffer;
+    size_t buffered;
+    uint64_t written; // bytes handed to the file so far
+    bool failed;
+};
+
+#endif
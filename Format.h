@@ -0,0 +1,121 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <cstdint>
+
+// Layout of a .huf file made of independent blocks (version 2), all numbers little-endian:
+//   file header: "HUF", version byte, block size (4 bytes), original size (8 bytes)
+//   blocks: original length (4), body length (4), block type (1), then the body
+//   end marker: a block header of type Block_end with both lengths 0
+//   directory: original offset (8) and file offset (8) of every block
+//   footer: directory offset (8), block count (8), "HUFD" and 4 reserved bytes
+// The original size is Huf_unknown_size when the input was a stream; the blocks still say
+// how long they are, and a reader can decode them in order without seeking to the directory.
+// A Block_huffman body holds the code length of every character, 4 bits each, low nibble
+// first (128 bytes), then the canonical codes, most significant bit first, last byte
+// padded with zeros. A block with a single distinct character has no code bits.
+// A Block_huffman_streams body splits the characters into a few equal runs, each its own
+// code stream so they can be decoded side by side: the same 128 bytes of code lengths, the
+// stream count (1 byte), the byte length of every stream but the last (4 bytes each), then
+// the streams one after another. Stream k holds characters k * ceil(n / count) onwards.
+// A Block_lz body is a list of sequences, each a run of literals followed by a copy of
+// earlier output: code lengths of the literals, the literal run codes, the match length codes
+// and the distance codes (128 bytes each), the sequence count (4), the literal count (4), the
+// byte length of the literal stream (4), the literal stream, then per sequence its literal run,
+// match length - 4 and distance - 1, each a code followed by extra bits (see lzCode). Literals
+// after the last sequence end the block. A table with a single code has no code bits.
+// A Block_ans body codes the characters with table-based ANS instead of Huffman codes: the
+// table log (1), a bitmap of the characters present (32 bytes, low bit first), their
+// normalized frequencies minus one in table-log bits each (most significant bit first,
+// padded to a byte), then the stream. The stream is read backwards from its last 1 bit:
+// the first state, the second state (table-log bits each), then per character the bits
+// of the state it was decoded from, even characters on the first state and odd ones on
+// the second. Both states end at 0.
+// A Block_context body codes every character with one of several code tables, picked by the
+// byte before it: the table count (1), the table of every previous byte (4 bits each, low
+// nibble first, 128 bytes), the code lengths of every table (128 bytes each), then the stream
+// count, jump table and streams as in Block_huffman_streams (with a stream count of 1 and no
+// jump table for a single stream). Every stream starts as if the byte before it were 0.
+// A Block_tokens body codes symbols of a larger alphabet: the 256 bytes, then byte pairs that
+// decode to both bytes. The token count (2), the two bytes of every token, the code lengths
+// of all 256 + count symbols (4 bits each, low nibble first), then the stream count, jump
+// table and streams as in Block_context. No token straddles the end of a stream's run.
+// A Block_stored body is the original bytes as they are, for data the codes do not shrink.
+// Any block type may have Block_checksum added: its body then ends with the CRC32C of the
+// block's original bytes (4 bytes), counted in the body length.
+//
+// Version 3 files are one message coded with a trained dictionary (see Dictionary.h): "HUF",
+// version byte, dictionary id (4 bytes), original size (8 bytes), then the canonical codes of
+// the dictionary in a single stream, last byte padded with zeros. No code lengths are stored.
+//
+// An archive (.hufa) holds many files: "HUFA", version byte and 3 reserved bytes, then every
+// file as a complete version 2 .huf file of its own, in any order, then the file table and a
+// footer. Each file table entry is the path length (2), the path relative to the archived
+// directory with '/' between components, the original size (8), the offset of the file's .huf
+// data in the archive (8) and its length (8). The footer is the table offset (8), the entry
+// count (8), "HUFT" and 4 reserved bytes.
+//
+// Version 1 files are one Huffman block without the block framing: "HUF", version byte,
+// original size (8 bytes) and the block body. Files starting with a decimal digit are the
+// older format, where the character count, a comma and the pre-order tree come first
+#define Huf_magic "HUF"
+#define Huf_version_canonical 1
+#define Huf_version_blocks 2
+#define Huf_version_dictionary 3
+#define Huf_lengths_size (256 / 2)
+#define Huf_header_size (4 + 8 + Huf_lengths_size)
+
+#define Huf_file_header_size 16
+#define Huf_block_header_size 9
+#define Huf_directory_entry_size 16
+#define Huf_footer_size 24
+#define Huf_footer_magic "HUFD"
+#define Huf_unknown_size UINT64_MAX
+
+#define Block_huffman 0
+#define Block_huffman_streams 1
+#define Block_lz 2
+#define Block_ans 3
+#define Block_stored 4
+#define Block_context 5
+#define Block_tokens 6
+#define Lz_tables 4
+#define Block_end 0xFF
+#define Block_checksum 0x80 // flag on the block type
+#define Checksum_size 4
+
+#define Default_streams 4
+#define Max_streams 8
+#define Min_stream_length 256 // shorter runs are not worth a stream of their own
+
+#define Dictionary_magic "HUFC"
+#define Dictionary_file_size (4 + 4 + Huf_lengths_size)
+
+#define Archive_magic "HUFA"
+#define Archive_version 1
+#define Archive_header_size 8
+#define Archive_footer_size 24
+#define Archive_footer_magic "HUFT"
+
+#define Default_block_size (1 << 20)
+#define Max_block_size (1u << 30)
+
+inline void store_le32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+inline uint32_t load_le32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline void store_le64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+inline uint64_t load_le64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+#endif
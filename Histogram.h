@@ -0,0 +1,11 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstddef>
+
+// Add the number of times every byte value occurs in data[0 .. size) to Count[256].
+// Counts go to several interleaved sub-tables so a run of the same byte does not wait on
+// its own previous increment; callers working block by block can call it once per block
+void countBytes(const unsigned char *data, size_t size, long long int Count[]);
+
+#endif
@@ -0,0 +1,114 @@
+#include <cstring>
+#include "Lz.h"
+
+using namespace std;
+
+#define Hash_bits 16
+#define No_position UINT32_MAX
+#define Lz_max_lazy 32 // matches at least this long are taken without looking one byte further
+
+// Chain steps, the match length that stops the search and the farthest distance searched, for
+// every level. Candidates further back end the walk, so a chain costs at most its part of the window
+static const int chain_depth[Lz_max_level + 1] = {0, 4, 8, 16, 32, 32, 64, 256, 512, 1024};
+static const uint32_t nice_length[Lz_max_level + 1] = {0, 16, 32, 32, 64, 128, 128, 258, 258, 258};
+static const uint32_t window_size[Lz_max_level + 1] = {0, 1 << 16, 1 << 16, 1 << 16, 1 << 16, 1 << 18, 1 << 18,
+                                                       1 << 20, 1 << 20, 1 << 20};
+
+static inline uint32_t hash4(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - Hash_bits);
+}
+
+// Length of the common prefix of a and b, at most limit bytes, 8 bytes at a time
+static inline uint32_t match_length(const unsigned char *a, const unsigned char *b, size_t limit) {
+    size_t n = 0;
+    while (n + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a + n, 8);
+        memcpy(&y, b + n, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        if (x != y) return n + (__builtin_clzll(x ^ y) >> 3);
+#else
+        if (x != y) return n + (__builtin_ctzll(x ^ y) >> 3); //lowest differing byte comes first
+#endif
+        n += 8;
+    }
+    while (n < limit && a[n] == b[n]) n++;
+    return n;
+}
+
+// Add every position before end that still has 4 bytes after it to the hash chains
+void MatchFinder::insert_until(size_t end) {
+    if (end > size - Lz_min_match + 1) end = size - Lz_min_match + 1;
+    for (; inserted < end; inserted++) {
+        uint32_t h = hash4(data + inserted);
+        chain[inserted] = head[h];
+        head[h] = inserted;
+    }
+}
+
+// Longest earlier match for position trying at most steps candidates, length 0 if there is none
+void MatchFinder::find(size_t position, int steps, uint32_t &length, uint32_t &distance) {
+    insert_until(position);
+    length = distance = 0;
+    size_t limit = size - position;
+    uint32_t candidate = head[hash4(data + position)];
+    for (; candidate != No_position && position - candidate <= window && steps > 0; steps--) {
+        //a longer match has to agree at the byte just past the current best
+        if (length < limit && data[candidate + length] == data[position + length]) {
+            uint32_t n = match_length(data + candidate, data + position, limit);
+            if (n > length) {
+                length = n;
+                distance = position - candidate;
+                if (n >= nice || n == limit) break;
+            }
+        }
+        candidate = chain[candidate];
+    }
+}
+
+void MatchFinder::parse(const unsigned char *in, size_t in_size, int level) {
+    found.clear();
+    literal_bytes.clear();
+    if (level < 1) level = 1;
+    if (level > Lz_max_level) level = Lz_max_level;
+    data = in;
+    size = in_size;
+    inserted = 0;
+    max_chain = chain_depth[level];
+    nice = nice_length[level];
+    window = window_size[level];
+
+    size_t anchor = 0; // first byte not covered by a sequence yet
+    if (size >= Lz_min_match) {
+        head.assign(1 << Hash_bits, No_position);
+        chain.resize(size);
+        size_t i = 0;
+        while (i + Lz_min_match <= size) {
+            uint32_t length, distance;
+            find(i, max_chain, length, distance);
+            if (length < Lz_min_match) {
+                //search less often the longer nothing has matched, so incompressible input passes
+                //quickly. The lazy levels slow down later
+                i += 1 + ((i - anchor) >> (level < Lz_lazy_level ? 6 : 8));
+                continue;
+            }
+            //lazy matching: a literal is worth it when the next position matches further. Only
+            //short matches are worth the second search, and it follows a quarter of the chain
+            while (level >= Lz_lazy_level && length < Lz_max_lazy && i + 1 + Lz_min_match <= size) {
+                uint32_t next_length, next_distance;
+                find(i + 1, max_chain / 4, next_length, next_distance);
+                if (next_length <= length) break;
+                i++;
+                length = next_length;
+                distance = next_distance;
+            }
+            found.push_back(LzSequence{(uint32_t)(i - anchor), length, distance});
+            literal_bytes.insert(literal_bytes.end(), data + anchor, data + i);
+            i += length;
+            anchor = i;
+        }
+    }
+    literal_bytes.insert(literal_bytes.end(), data + anchor, data + size);
+}
@@ -0,0 +1,72 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define Lz_min_match 4 // shortest match worth a sequence
+#define Lz_max_level 9
+#define Lz_lazy_level 5 // levels from here on check whether the next position has a longer match
+
+// Literals copied from the literal stream followed by a copy of earlier output
+struct LzSequence {
+    uint32_t literals;
+    uint32_t length;   // at least Lz_min_match
+    uint32_t distance; // how far back the match starts, at least 1
+};
+
+// Hash-chain match finder splitting a block into sequences and the literals between them.
+// Higher levels follow the chains further. The tables are kept from one block to the next
+class MatchFinder {
+public:
+    // level from 1 (fastest) to Lz_max_level (smallest output)
+    void parse(const unsigned char *data, size_t size, int level);
+
+    const std::vector<LzSequence> &sequences() const { return found; }
+    // Literals of every sequence in order, then the ones after the last match
+    const std::vector<unsigned char> &literals() const { return literal_bytes; }
+
+private:
+    void insert_until(size_t end);
+    void find(size_t position, int steps, uint32_t &length, uint32_t &distance);
+
+    const unsigned char *data;
+    size_t size;
+    size_t inserted; // positions below this are in the hash chains
+    int max_chain;   // candidates tried per position
+    uint32_t nice;   // a match this long ends the search
+    uint32_t window; // farthest distance searched
+    std::vector<uint32_t> head;  // latest position of every hash
+    std::vector<uint32_t> chain; // previous position with the same hash
+    std::vector<LzSequence> found;
+    std::vector<unsigned char> literal_bytes;
+};
+
+// Lengths and distances are entropy coded as a code plus extra bits. Values below 16 are
+// their own code, larger ones keep their top three bits in the code and send the rest as
+// extra bits, so codes stay below 128 for any 32-bit value
+inline int lzCode(uint32_t value, int &extra_bits) {
+    if (value < 16) {
+        extra_bits = 0;
+        return value;
+    }
+    int top = 31 - __builtin_clz(value);
+    extra_bits = top - 2;
+    return 16 + (top - 4) * 4 + ((value >> (top - 2)) & 3);
+}
+
+// Value of a code before its extra bits are added
+inline uint32_t lzBase(int code, int &extra_bits) {
+    if (code < 16) {
+        extra_bits = 0;
+        return code;
+    }
+    int top = (code - 16) / 4 + 4;
+    extra_bits = top - 2;
+    return (4u | ((code - 16) & 3)) << (top - 2);
+}
+
+#define Lz_max_code (16 + 27 * 4 + 3) // code of the largest 32-bit value
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Bounded queue between one producer thread and one consumer thread, without locks: a ring of
+// slots where only the producer moves tail and only the consumer moves head
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity + 1), head(0), tail(0) {}
+
+    // False when the queue is full
+    bool push(const T &value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = t + 1 == slots.size() ? 0 : t + 1;
+        if (next == head.load(std::memory_order_acquire)) return false;
+        slots[t] = value;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // False when the queue is empty
+    bool pop(T &value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        value = slots[h];
+        head.store(h + 1 == slots.size() ? 0 : h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Pop, waiting while the queue is empty unless stop is set (then false). Spins briefly
+    // and then sleeps in short steps, so a waiting stage does not hold a core. The time spent
+    // waiting is added to stalled, in nanoseconds
+    bool pop_wait(T &value, const std::atomic<bool> &stop, uint64_t &stalled) {
+        if (pop(value)) return true;
+        auto start = std::chrono::steady_clock::now();
+        for (int spin = 0; !pop(value); spin++) {
+            if (stop.load(std::memory_order_relaxed)) return false;
+            if (spin < 64) std::this_thread::yield();
+            else std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        stalled += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        return true;
+    }
+
+    // Items queued, exact only on the consumer's thread when the producer is idle
+    size_t size() const {
+        size_t h = head.load(std::memory_order_acquire), t = tail.load(std::memory_order_acquire);
+        return t >= h ? t - h : t + slots.size() - h;
+    }
+
+private:
+    SpscQueue(const SpscQueue &);
+    SpscQueue &operator=(const SpscQueue &);
+
+    std::vector<T> slots; // one more than the capacity, so full and empty differ
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+#endif
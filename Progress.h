@@ -0,0 +1,19 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <atomic>
+#include <cstdint>
+
+// Progress of a compression or decompression running on another thread. The job adds the
+// original (uncompressed) bytes it has finished to done, and stops as soon as it sees cancel:
+// it then fails and removes the partial output file
+struct JobProgress {
+    std::atomic<uint64_t> done{0};  // original bytes finished so far
+    std::atomic<uint64_t> total{0}; // original bytes in all, 0 while unknown. A job only sets it while it is 0
+    std::atomic<bool> cancel{false};
+
+    bool cancelled() const { return cancel.load(std::memory_order_relaxed); }
+    void add(uint64_t bytes) { done.fetch_add(bytes, std::memory_order_relaxed); }
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#define Phase_histogram 0 // counting the characters
+#define Phase_tree 1      // code lengths: Huffman tree and length limit, or ANS normalization
+#define Phase_codes 2     // canonical codes from the lengths, or the decode tables
+#define Phase_match 3     // LZ match finding
+#define Phase_encode 4    // coding the characters and writing the output
+#define Phase_header 5    // reading the block directory, block headers and code lengths
+#define Phase_decode 6    // decoding the characters and checking block checksums
+#define Phase_count 7
+
+#define Stage_read 0   // reading the input, waits for a free buffer
+#define Stage_encode 1 // coding the blocks, waits for input
+#define Stage_write 2  // writing them out, waits for coded blocks
+#define Stage_count 3
+
+inline const char *stageName(int stage) {
+    static const char *const names[Stage_count] = {"read", "encode", "write"};
+    return names[stage];
+}
+
+inline const char *phaseName(int phase) {
+    static const char *const names[Phase_count] = {"histogram", "tree build", "code tables", "LZ matching",
+                                                   "encode/write", "header parse", "decode"};
+    return names[phase];
+}
+
+// Where the time of a compression or decompression went, filled in when passed in the options.
+// Phase times are summed over all threads, so with several threads they can add up to more
+// than the wall time. Without stats nothing is measured
+struct JobStats {
+    std::atomic<uint64_t> nanoseconds[Phase_count] = {};
+    std::atomic<uint64_t> bytes[Phase_count] = {}; // original bytes that went through each phase
+    std::atomic<uint64_t> wall_nanoseconds{0};      // whole job, set at the end
+    std::atomic<uint64_t> symbols{0};               // characters of Huffman and ANS blocks, LZ blocks are not counted
+    std::atomic<uint64_t> code_bits{0};             // bits those characters took
+    std::atomic<int> max_code_length{0};
+    std::atomic<uint64_t> stall_nanoseconds[Stage_count] = {}; // time each stage of a compression pipeline waited
+    std::atomic<int> queue_peak[Stage_count] = {};             // most buffers found waiting for each stage
+
+    void add(int phase, uint64_t time, uint64_t size) {
+        nanoseconds[phase].fetch_add(time, std::memory_order_relaxed);
+        bytes[phase].fetch_add(size, std::memory_order_relaxed);
+    }
+    void add_codes(uint64_t count, uint64_t bits, int longest) {
+        symbols.fetch_add(count, std::memory_order_relaxed);
+        code_bits.fetch_add(bits, std::memory_order_relaxed);
+        int seen = max_code_length.load(std::memory_order_relaxed);
+        while (longest > seen && !max_code_length.compare_exchange_weak(seen, longest, std::memory_order_relaxed)) {}
+    }
+
+    void add_stall(int stage, uint64_t time, int queued) {
+        stall_nanoseconds[stage].fetch_add(time, std::memory_order_relaxed);
+        int seen = queue_peak[stage].load(std::memory_order_relaxed);
+        while (queued > seen && !queue_peak[stage].compare_exchange_weak(seen, queued, std::memory_order_relaxed)) {}
+    }
+
+    double seconds(int phase) const { return nanoseconds[phase] / 1e9; }
+    double megabytes_per_second(int phase) const {
+        return nanoseconds[phase] ? bytes[phase] / seconds(phase) / (1024 * 1024) : 0;
+    }
+    double average_bits() const { return symbols ? (double)code_bits / symbols : 0; }
+};
+
+inline uint64_t nanoseconds_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Hands the time since the previous lap to a phase. Without stats it reads no clock, so
+// the cost of disabled stats is one branch per lap, and laps are per block
+class PhaseClock {
+public:
+    explicit PhaseClock(JobStats *stats) : stats(stats), last(stats ? nanoseconds_now() : 0) {}
+
+    void lap(int phase, uint64_t size) {
+        if (!stats) return;
+        uint64_t now = nanoseconds_now();
+        stats->add(phase, now - last, size);
+        last = now;
+    }
+
+private:
+    JobStats *stats;
+    uint64_t last;
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include "ThreadPool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int threads) : stopping(false) {
+    if (threads <= 0) threads = max(1u, thread::hardware_concurrency());
+    //the thread calling parallel_for works too, so one thread needs no workers
+    for (int i = 1; i < threads; i++)
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(jobs_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread &worker : workers) worker.join();
+}
+
+void ThreadPool::submit(function<void()> job) {
+    {
+        lock_guard<mutex> lock(jobs_mutex);
+        jobs.push_back(move(job));
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::worker_loop() {
+    while (true) {
+        function<void()> job;
+        {
+            unique_lock<mutex> lock(jobs_mutex);
+            wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty()) return;
+            job = move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
+void ThreadPool::parallel_for(size_t count, const function<void(size_t)> &body) {
+    if (count == 0) return;
+    if (count == 1 || workers.empty()) {
+        for (size_t i = 0; i < count; i++) body(i);
+        return;
+    }
+
+    //every participant takes the next index until none are left
+    struct Loop {
+        atomic<size_t> next{0};
+        size_t done = 0;
+        mutex lock;
+        condition_variable finished;
+    };
+    shared_ptr<Loop> loop = make_shared<Loop>();
+    auto run = [loop, count, &body] {
+        size_t ran = 0;
+        for (size_t i = loop->next++; i < count; i = loop->next++, ran++)
+            body(i);
+        if (ran) {
+            lock_guard<mutex> guard(loop->lock);
+            loop->done += ran;
+            if (loop->done == count) loop->finished.notify_all();
+        }
+    };
+    size_t helpers = min(workers.size(), count - 1);
+    for (size_t i = 0; i < helpers; i++) submit(run);
+    run();
+
+    unique_lock<mutex> guard(loop->lock);
+    loop->finished.wait(guard, [&] { return loop->done == count; });
+}
+
+void ThreadPool::parallel_steal(size_t count, const function<void(size_t, int)> &body) {
+    if (count == 0) return;
+    if (count == 1 || workers.empty()) {
+        for (size_t i = 0; i < count; i++) body(i, 0);
+        return;
+    }
+
+    //indices [begin, end) still to run, the owner takes from the front and thieves from the back
+    struct Share {
+        mutex lock;
+        size_t begin = 0, end = 0;
+    };
+    const int participants = min(workers.size(), count - 1) + 1;
+    struct Loop {
+        vector<Share> shares;
+        atomic<int> joined{0};
+        size_t done = 0;
+        mutex lock;
+        condition_variable finished;
+        explicit Loop(int n) : shares(n) {}
+    };
+    shared_ptr<Loop> loop = make_shared<Loop>(participants);
+    for (int p = 0; p < participants; p++) {
+        loop->shares[p].begin = count * p / participants;
+        loop->shares[p].end = count * (p + 1) / participants;
+    }
+
+    auto run = [loop, count, participants, &body] {
+        const int me = loop->joined++;
+        Share &own = loop->shares[me];
+        size_t ran = 0;
+        while (true) {
+            size_t i = count;
+            {
+                lock_guard<mutex> guard(own.lock);
+                if (own.begin < own.end) i = own.begin++;
+            }
+            if (i < count) {
+                body(i, me);
+                ran++;
+                continue;
+            }
+            //steal the back half of the largest share left
+            int victim = -1;
+            size_t most = 0;
+            for (int p = 0; p < participants; p++) {
+                if (p == me) continue;
+                lock_guard<mutex> guard(loop->shares[p].lock);
+                size_t left = loop->shares[p].end - loop->shares[p].begin;
+                if (left > most) {
+                    most = left;
+                    victim = p;
+                }
+            }
+            if (victim < 0) break;
+            size_t begin, end;
+            {
+                Share &share = loop->shares[victim];
+                lock_guard<mutex> guard(share.lock);
+                size_t left = share.end - share.begin;
+                if (left == 0) continue; //taken by its owner or another thief in the meantime
+                end = share.end;
+                begin = end - (left + 1) / 2;
+                share.end = begin;
+            }
+            lock_guard<mutex> guard(own.lock);
+            own.begin = begin;
+            own.end = end;
+        }
+        if (ran) {
+            lock_guard<mutex> guard(loop->lock);
+            loop->done += ran;
+            if (loop->done == count) loop->finished.notify_all();
+        }
+    };
+    for (int i = 1; i < participants; i++) submit(run);
+    run();
+
+    unique_lock<mutex> guard(loop->lock);
+    loop->finished.wait(guard, [&] { return loop->done == count; });
+}
+
+ThreadPool &ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
@@ -0,0 +1,44 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running queued jobs
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads = 0); // 0 starts one thread per core
+    ~ThreadPool();
+
+    // Threads taking part in parallel_for, the caller included
+    int size() const { return workers.size() + 1; }
+
+    // Run body(0) .. body(count - 1) on the workers and the calling thread, returns when all are done
+    void parallel_for(size_t count, const std::function<void(size_t)> &body);
+
+    // Same with work stealing: every participant starts on its own contiguous share of the
+    // indices and takes half of the largest remaining share when its own runs out, so short
+    // tasks are not held up behind long ones. body also gets the participant number, below
+    // size(), for per-thread scratch memory
+    void parallel_steal(size_t count, const std::function<void(size_t, int)> &body);
+
+    // Pool shared by callers that do not ask for a particular number of threads
+    static ThreadPool &shared();
+
+private:
+    void submit(std::function<void()> job);
+    void worker_loop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex jobs_mutex;
+    std::condition_variable wake;
+    bool stopping;
+};
+
+#endif
@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <cstring>
+#include "Tokens.h"
+#include "BitIO.h"
+#include "Format.h"
+
+using namespace std;
+
+// Split in[0 .. end) into symbols: the token of the next two bytes when they are one,
+// otherwise the next byte
+template <typename Emit>
+static inline void parse(const unsigned char *in, const unsigned char *end, const uint16_t pair_token[], Emit emit) {
+    while (end - in >= 2) {
+        unsigned token = pair_token[in[0] << 8 | in[1]];
+        if (token) {
+            emit(token);
+            in += 2;
+        } else {
+            emit(*in++);
+        }
+    }
+    if (in < end) emit(*in);
+}
+
+int chooseTokens(const unsigned char *data, size_t size, int max_tokens, int streams, TokenScratch &scratch) {
+    vector<uint32_t> &pair_counts = scratch.pair_counts;
+    pair_counts.assign(1 << 16, 0);
+    for (size_t i = 0; i + 1 < size; i++) pair_counts[data[i] << 8 | data[i + 1]]++;
+
+    //the most frequent pairs, ties by value so the choice does not depend on the sort
+    scratch.pairs.clear();
+    for (uint32_t value = 0; value < (1 << 16); value++)
+        if (pair_counts[value] >= Min_token_count) scratch.pairs.push_back(value);
+    size_t tokens = min<size_t>(scratch.pairs.size(), max(0, min(max_tokens, Max_tokens)));
+    partial_sort(scratch.pairs.begin(), scratch.pairs.begin() + tokens, scratch.pairs.end(), [&](uint16_t a, uint16_t b) {
+        return pair_counts[a] != pair_counts[b] ? pair_counts[a] > pair_counts[b] : a < b;
+    });
+    scratch.pairs.resize(tokens);
+    sort(scratch.pairs.begin(), scratch.pairs.end());
+    if (tokens == 0) return 0;
+
+    scratch.pair_token.assign(1 << 16, 0);
+    for (size_t t = 0; t < tokens; t++) scratch.pair_token[scratch.pairs[t]] = 256 + t;
+    memset(scratch.count, 0, sizeof(scratch.count));
+    size_t run = (size + streams - 1) / streams;
+    uint64_t *count = scratch.count;
+    for (size_t first = 0; first < size; first += run)
+        parse(data + first, data + min(first + run, size), scratch.pair_token.data(), [&](unsigned symbol) { count[symbol]++; });
+    return tokens;
+}
+
+void tokenCodeLengths(int n, int max_length, TokenScratch &scratch) {
+    const uint64_t *count = scratch.count;
+    uint8_t *lengths = scratch.lengths;
+    vector<int> &leaves = scratch.order; //the vectors keep their capacity from one block to the next
+    leaves.clear();
+    for (int s = 0; s < n; s++) {
+        lengths[s] = 0;
+        if (count[s]) leaves.push_back(s);
+    }
+    int m = leaves.size();
+    if (m == 0) return;
+    if (m == 1) {
+        lengths[leaves[0]] = 1;
+        return;
+    }
+    sort(leaves.begin(), leaves.end(), [&](int a, int b) { return count[a] != count[b] ? count[a] < count[b] : a < b; });
+
+    //Huffman tree by two queues: the sorted leaves and the merged nodes, made in order of
+    //weight. Children come before their parent, so depths follow from the root downwards
+    vector<uint64_t> &weight = scratch.weight;
+    vector<int> &parent = scratch.parent, &depth = scratch.depth;
+    weight.resize(2 * m - 1);
+    parent.resize(2 * m - 1);
+    depth.resize(2 * m - 1);
+    for (int i = 0; i < m; i++) weight[i] = count[leaves[i]];
+    int leaf = 0, merged = m, used = m;
+    auto smallest = [&]() { return leaf < m && (merged == used || weight[leaf] <= weight[merged]) ? leaf++ : merged++; };
+    while (used < 2 * m - 1) {
+        int left = smallest(), right = smallest();
+        weight[used] = weight[left] + weight[right];
+        parent[left] = parent[right] = used++;
+    }
+    depth[used - 1] = 0;
+    for (int i = used - 2; i >= 0; i--) depth[i] = depth[parent[i]] + 1;
+
+    //codes over the limit are cut to it, then codes are moved one bit down from the longest
+    //length below the limit until the lengths fit (Kraft sum at most 1 again)
+    int per_length[Token_code_length + 1] = {0};
+    for (int i = 0; i < m; i++) per_length[min(depth[i], max_length)]++;
+    uint64_t total = 0;
+    for (int l = 1; l <= max_length; l++) total += (uint64_t)per_length[l] << (max_length - l);
+    while (total > (1u << max_length)) {
+        per_length[max_length]--;
+        for (int l = max_length - 1; l > 0; l--)
+            if (per_length[l]) {
+                per_length[l]--;
+                per_length[l + 1] += 2;
+                break;
+            }
+        total--;
+    }
+    //the rarest symbols get the longest codes
+    int i = 0;
+    for (int l = max_length; l >= 1; l--)
+        for (int k = 0; k < per_length[l]; k++) lengths[leaves[i++]] = l;
+}
+
+void tokenCanonicalCodes(const uint8_t lengths[], int n, uint16_t code[]) {
+    int per_length[Token_code_length + 2] = {0};
+    for (int s = 0; s < n; s++) per_length[lengths[s]]++;
+    per_length[0] = 0;
+    uint16_t next[Token_code_length + 2];
+    uint32_t value = 0;
+    for (int l = 1; l <= Token_code_length; l++) {
+        value = (value + per_length[l - 1]) << 1;
+        next[l] = value;
+    }
+    for (int s = 0; s < n; s++)
+        if (lengths[s]) code[s] = next[lengths[s]]++;
+}
+
+unsigned char *tokenEncode(const unsigned char *data, size_t size, int streams, const TokenScratch &scratch, unsigned char *out) {
+    static_assert(4 * Token_code_length <= 56, "four codes must fit between two flushes");
+    *out++ = streams;
+    unsigned char *jump = out, *end = out + 4 * (streams - 1);
+    size_t run = (size + streams - 1) / streams;
+    const uint16_t *code = scratch.code;
+    const uint8_t *lengths = scratch.lengths;
+    for (int k = 0; k < streams; k++) {
+        unsigned char *start = end;
+        BitWriter writer(end);
+        int pending = 0;
+        parse(data + min(k * run, size), data + min(k * run + run, size), scratch.pair_token.data(), [&](unsigned symbol) {
+            writer.put(code[symbol], lengths[symbol]);
+            if (++pending == 4) {
+                writer.flush();
+                pending = 0;
+            }
+        });
+        end = writer.finish();
+        if (k < streams - 1) store_le32(jump + 4 * k, end - start);
+    }
+    return end;
+}
+
+bool buildTokenDecodeTable(const uint16_t pairs[], int tokens, const uint8_t lengths[], TokenDecodeTable &table) {
+    const int slots = 1 << Token_code_length, n = 256 + tokens;
+    uint32_t kraft = 0; //slots taken, the codes must fill the table
+    int used = 0;
+    for (int s = 0; s < n; s++) {
+        if (lengths[s] > Token_code_length) return false;
+        if (lengths[s]) {
+            kraft += slots >> lengths[s];
+            used++;
+        }
+    }
+    //a block of one symbol has a single 1-bit code and leaves half the table empty
+    if (kraft != slots && !(used == 1 && kraft == slots / 2)) return false;
+    uint16_t code[Token_alphabet];
+    tokenCanonicalCodes(lengths, n, code);
+
+    //one symbol per slot first
+    vector<TokenEntry> &entries = table.entries;
+    entries.assign(slots, TokenEntry{{0, 0, 0, 0}, 0, 0, 0, 0});
+    for (int s = 0; s < n; s++) {
+        if (!lengths[s]) continue;
+        TokenEntry entry = {{0, 0, 0, 0}, 1, lengths[s], 1, lengths[s]};
+        if (s < 256) {
+            entry.bytes[0] = s;
+        } else {
+            entry.bytes[0] = pairs[s - 256] >> 8;
+            entry.bytes[1] = pairs[s - 256] & 0xFF;
+            entry.length = entry.first = 2;
+        }
+        int first = code[s] << (Token_code_length - lengths[s]);
+        for (int i = 0; i < slots >> lengths[s]; i++) entries[first + i] = entry;
+    }
+    //then a second symbol wherever its whole code fits in the bits the first one leaves
+    vector<TokenEntry> &single = table.single;
+    single.assign(entries.begin(), entries.end());
+    for (int i = 0; i < slots; i++) {
+        TokenEntry &entry = entries[i];
+        if (!entry.bits) continue;
+        const TokenEntry &next = single[(i << entry.bits) & (slots - 1)];
+        if (!next.bits || entry.bits + next.bits > Token_code_length) continue;
+        memcpy(entry.bytes + entry.length, next.bytes, next.length);
+        entry.length += next.length;
+        entry.bits += next.bits;
+    }
+    return true;
+}
+
+// Decode N streams in the same loop so their lookups overlap in the CPU. Every lookup writes
+// four bytes and moves on by the ones it decoded
+template <int N>
+static bool decode_runs(const TokenDecodeTable &table, BitReader readers[], unsigned char *out[], unsigned char *end[]) {
+    BitReader reader[N];
+    unsigned char *o[N];
+    for (int s = 0; s < N; s++) {
+        reader[s] = readers[s];
+        o[s] = out[s];
+    }
+    const TokenEntry *entries = table.entries.data();
+
+    auto room = [&]() {
+        for (int s = 0; s < N; s++)
+            if (end[s] - o[s] < 16) return false;
+        return true;
+    };
+    while (room()) {
+#pragma GCC unroll 8
+        for (int s = 0; s < N; s++) reader[s].refill();
+#pragma GCC unroll 4
+        for (int k = 0; k < 4; k++)
+#pragma GCC unroll 8
+            for (int s = 0; s < N; s++) {
+                const TokenEntry &entry = entries[reader[s].peek(Token_code_length)];
+                if (!entry.bits) return false; //would not move on, the stream would never end
+                memcpy(o[s], entry.bytes, 4);
+                o[s] += entry.length;
+                reader[s].consume(entry.bits);
+            }
+    }
+    //the rest one symbol at a time, a pair of symbols only when both belong to the run
+    for (int s = 0; s < N; s++) {
+        while (o[s] < end[s]) {
+            reader[s].refill();
+            const TokenEntry &entry = entries[reader[s].peek(Token_code_length)];
+            if (!entry.bits) return false;
+            size_t left = end[s] - o[s];
+            int length = entry.length <= left ? entry.length : entry.first;
+            if ((size_t)length > left) return false;
+            memcpy(o[s], entry.bytes, length);
+            o[s] += length;
+            reader[s].consume(length == entry.length ? entry.bits : entry.first_bits);
+        }
+        if (reader[s].exhausted()) return false;
+    }
+    return true;
+}
+
+bool tokenDecode(const TokenDecodeTable &table, const unsigned char *in, size_t in_size, unsigned char *out, size_t size) {
+    if (in_size < 1) return false;
+    int streams = in[0];
+    if (streams < 1 || streams > Max_streams || in_size < 1 + 4 * (size_t)(streams - 1)) return false;
+    const unsigned char *jump = in + 1, *p = jump + 4 * (streams - 1), *in_end = in + in_size;
+    size_t run = (size + streams - 1) / streams;
+
+    BitReader readers[Max_streams];
+    unsigned char *starts[Max_streams], *ends[Max_streams];
+    for (int k = 0; k < streams; k++) {
+        size_t length = k < streams - 1 ? load_le32(jump + 4 * k) : in_end - p;
+        if (length > (size_t)(in_end - p)) return false;
+        readers[k] = BitReader(p, p + length);
+        p += length;
+        size_t first = min(k * run, size);
+        starts[k] = out + first;
+        ends[k] = out + min(first + run, size);
+    }
+
+    switch (streams) {
+    case 1: return decode_runs<1>(table, readers, starts, ends);
+    case 2: return decode_runs<2>(table, readers, starts, ends);
+    case 3: return decode_runs<3>(table, readers, starts, ends);
+    case 4: return decode_runs<4>(table, readers, starts, ends);
+    case 5: return decode_runs<5>(table, readers, starts, ends);
+    case 6: return decode_runs<6>(table, readers, starts, ends);
+    case 7: return decode_runs<7>(table, readers, starts, ends);
+    default: return decode_runs<8>(table, readers, starts, ends);
+    }
+}
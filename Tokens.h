@@ -0,0 +1,67 @@
+#ifndef TOKENS_H
+#define TOKENS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define Token_alphabet 4096 // symbols of a token block: the 256 bytes, then the byte pair tokens
+#define Max_tokens (Token_alphabet - 256)
+#define Token_code_length 12 // longest code of a token block, one table lookup decodes any code
+#define Min_token_count 16   // rarer byte pairs do not pay for their place in the header
+
+// Byte pair alphabet of a block and its codes, kept from one block to the next
+struct TokenScratch {
+    std::vector<uint32_t> pair_counts; // pair_counts[first << 8 | second]
+    std::vector<uint16_t> pair_token;  // symbol of every pair that is a token, 0 for the others
+    std::vector<uint16_t> pairs;       // the pair of every token, first byte high
+    uint64_t count[Token_alphabet];
+    uint8_t lengths[Token_alphabet];
+    uint16_t code[Token_alphabet];
+    std::vector<int> order;        // symbols by count, the leaves of the Huffman tree
+    std::vector<uint64_t> weight;  // leaves, then the merged nodes
+    std::vector<int> parent, depth;
+};
+
+// Pick up to max_tokens of the most frequent byte pairs of data as tokens, then count the
+// symbols of data split into streams runs of tokens and single bytes. Returns the number of
+// tokens, 0 when no pair is frequent enough
+int chooseTokens(const unsigned char *data, size_t size, int max_tokens, int streams, TokenScratch &scratch);
+
+// Code lengths no longer than max_length for scratch.count of n symbols into scratch.lengths,
+// the rarest symbols get the longest codes. Needs 2^max_length >= n
+void tokenCodeLengths(int n, int max_length, TokenScratch &scratch);
+
+// Canonical codes of the lengths of n symbols, shorter codes first, equal lengths by symbol
+void tokenCanonicalCodes(const uint8_t lengths[], int n, uint16_t code[]);
+
+// Code data split into streams equal runs, each its own stream of tokens and single bytes.
+// out needs room for size codes of Token_code_length bits plus the jump table and 8 spare
+// bytes. Returns the end of the data
+unsigned char *tokenEncode(const unsigned char *data, size_t size, int streams, const TokenScratch &scratch, unsigned char *out);
+
+// One slot of a token decode table: up to four output bytes from one or two symbols, and the
+// bits of their codes. 0 bits for a bit pattern no code starts with
+struct TokenEntry {
+    uint8_t bytes[4];
+    uint8_t length; // output bytes
+    uint8_t bits;
+    uint8_t first;  // output bytes of the first symbol, for a slot cut short at the end of a run
+    uint8_t first_bits;
+};
+
+// 2^Token_code_length slots, indexed by the next Token_code_length bits
+struct TokenDecodeTable {
+    std::vector<TokenEntry> entries;
+    std::vector<TokenEntry> single; // one symbol per slot, while the pairs are put together
+};
+
+// Build the table from the pair of every token and the code lengths of all symbols, false
+// when the lengths are not a complete prefix code (a lone symbol may have a 1-bit code), so
+// only bit patterns that cannot occur in a valid stream lead to an empty slot
+bool buildTokenDecodeTable(const uint16_t pairs[], int tokens, const uint8_t lengths[], TokenDecodeTable &table);
+
+// Decode the streams of tokenEncode into size bytes, false if they are not valid
+bool tokenDecode(const TokenDecodeTable &table, const unsigned char *in, size_t in_size, unsigned char *out, size_t size);
+
+#endif
@@ -0,0 +1,316 @@
+// Headless benchmark: compresses and decompresses a corpus of inputs several times, checks
+// every round trip and prints the results as JSON. Builds without FLTK:
+//   g++ -std=c++17 -O2 -pthread -o bench bench.cpp Encode.cpp Decode.cpp CodeTable.cpp Histogram.cpp Lz.cpp Ans.cpp Context.cpp Tokens.cpp Dictionary.cpp Checksum.cpp ThreadPool.cpp FileIO.cpp
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "Encode.h"
+#include "Decode.h"
+
+using namespace std;
+
+struct Input {
+    string name;
+    string path;
+};
+
+struct Result {
+    Input input;
+    string backend;
+    long long size;
+    long long compressed_size;
+    bool verified;
+    vector<double> compress_seconds;
+    vector<double> decompress_seconds;
+    double stall_ms[Stage_count]; // compression pipeline stalls per iteration
+    int queue_peak[Stage_count];
+};
+
+static bool write_file(const string &path, const vector<unsigned char> &data) {
+    ofstream out(path.c_str(), ios::binary);
+    out.write((const char *)data.data(), data.size());
+    return (bool)out;
+}
+
+static bool read_file(const string &path, vector<unsigned char> &data) {
+    ifstream in(path.c_str(), ios::binary);
+    if (!in) return false;
+    data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    return true;
+}
+
+// Synthetic inputs: uniform random bytes, a skewed distribution, English-like text, a single
+// repeated character and an empty file
+static vector<unsigned char> make_input(const string &name, size_t size) {
+    mt19937 random(12345);
+    vector<unsigned char> data(size);
+    if (name == "random") {
+        for (size_t i = 0; i < size; i++) data[i] = random() & 0xFF;
+    } else if (name == "skewed") {
+        geometric_distribution<int> pick(0.15); //a few characters take most of the input
+        for (size_t i = 0; i < size; i++) data[i] = min(pick(random), 255);
+    } else if (name == "text") {
+        static const char *words[] = {"the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was",
+                                      "with", "be", "by", "on", "not", "he", "this", "are", "or", "his", "from",
+                                      "at", "which", "but", "have", "an", "had", "they", "compression", "huffman",
+                                      "frequency", "tree", "symbol", "block", "decode", "table", "file", "data"};
+        const int count = sizeof(words) / sizeof(words[0]);
+        size_t i = 0, line = 0;
+        while (i < size) {
+            int w = min((int)(exponential_distribution<double>(0.12)(random)), count - 1); //common words first
+            for (const char *c = words[w]; *c && i < size; c++) data[i++] = *c;
+            if (i < size) data[i++] = ++line % 12 ? ' ' : '\n';
+        }
+    } else if (name == "single") {
+        fill(data.begin(), data.end(), 'a');
+    } else {
+        data.clear();
+    }
+    return data;
+}
+
+// Nearest-rank percentile of sorted values
+static double percentile(const vector<double> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)(p / 100 * sorted.size() + 0.999999);
+    return sorted[min(max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+static string json_string(const string &s) {
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static double median_speed(const vector<double> &seconds, long long size) {
+    vector<double> sorted = seconds;
+    sort(sorted.begin(), sorted.end());
+    double s = percentile(sorted, 50);
+    return s > 0 ? size / s / (1024 * 1024) : 0;
+}
+
+// Timing summary of one direction: milliseconds and MB/s of the original size
+static void write_timings(ostream &out, const vector<double> &seconds, long long size) {
+    vector<double> sorted = seconds;
+    sort(sorted.begin(), sorted.end());
+    auto speed = [&](double s) { return s > 0 ? size / s / (1024 * 1024) : 0; };
+    out << "{\"ms\": {\"min\": " << sorted.front() * 1000 << ", \"p50\": " << percentile(sorted, 50) * 1000
+        << ", \"p90\": " << percentile(sorted, 90) * 1000 << ", \"p99\": " << percentile(sorted, 99) * 1000
+        << ", \"max\": " << sorted.back() * 1000 << "}, \"mb_per_s\": {\"max\": " << speed(sorted.front())
+        << ", \"p50\": " << speed(percentile(sorted, 50)) << ", \"p90\": " << speed(percentile(sorted, 90))
+        << ", \"p99\": " << speed(percentile(sorted, 99)) << ", \"min\": " << speed(sorted.back()) << "}}";
+}
+
+static Result run_input(const Input &input, const string &work, int iterations, const CompressOptions &compress_options,
+                        const DecompressOptions &decompress_options) {
+    Result result;
+    result.input = input;
+    result.compressed_size = 0;
+    result.verified = false;
+    vector<unsigned char> original, decoded;
+    if (!read_file(input.path, original)) {
+        cerr << "Error: Could not read " << input.path << "\n";
+        result.size = -1;
+        return result;
+    }
+    result.size = original.size();
+    string compressed = work + "/" + input.name + ".huf", restored = work + "/" + input.name + ".out";
+
+    result.verified = true;
+    JobStats stats;
+    CompressOptions options = compress_options;
+    options.stats = &stats;
+    for (int i = 0; i < iterations; i++) {
+        //decompressFile reports to cout, which would end up in the JSON
+        streambuf *console = cout.rdbuf(NULL);
+        auto start = chrono::steady_clock::now();
+        bool compressed_ok = compressFile(input.path, compressed, options);
+        auto middle = chrono::steady_clock::now();
+        bool decompressed_ok = compressed_ok && decompressFile(compressed, restored, decompress_options);
+        auto stop = chrono::steady_clock::now();
+        cout.rdbuf(console);
+        cout.clear();
+
+        result.compress_seconds.push_back(chrono::duration<double>(middle - start).count());
+        result.decompress_seconds.push_back(chrono::duration<double>(stop - middle).count());
+        vector<unsigned char> packed;
+        if (read_file(compressed, packed)) result.compressed_size = packed.size();
+        if (!decompressed_ok || !read_file(restored, decoded) || decoded != original) result.verified = false;
+    }
+    for (int stage = 0; stage < Stage_count; stage++) {
+        result.stall_ms[stage] = stats.stall_nanoseconds[stage] / 1e6 / iterations;
+        result.queue_peak[stage] = stats.queue_peak[stage];
+    }
+    unlink(compressed.c_str());
+    unlink(restored.c_str());
+    return result;
+}
+
+static void usage() {
+    cerr << "Usage: bench [-n iterations] [-s synthetic size] [-b block size] [-l LZ level] [-t threads] [-e huffman,ans,auto]\n"
+            "             [-c] [-p pipeline depth] [-x context tables] [-w byte pair tokens] [-o results.json] [files...]\n";
+}
+
+static const char *backend_names[] = {"huffman", "ans", "auto"}; // indexed by Backend_*
+
+// Comma separated backend names, false on an unknown one
+static bool parse_backends(const string &list, vector<int> &backends) {
+    backends.clear();
+    stringstream names(list);
+    string name;
+    while (getline(names, name, ',')) {
+        int b = 0;
+        while (b <= Backend_auto && name != backend_names[b]) b++;
+        if (b > Backend_auto) return false;
+        backends.push_back(b);
+    }
+    return !backends.empty();
+}
+
+int main(int argc, char **argv) {
+    int iterations = 5;
+    size_t synthetic_size = 8 << 20;
+    string json_path;
+    CompressOptions compress_options;
+    DecompressOptions decompress_options;
+    vector<string> files;
+    vector<int> backends = {Backend_huffman, Backend_ans}; //the Huffman path is the baseline the others are compared to
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = arg == "-n" || arg == "-s" || arg == "-b" || arg == "-l" || arg == "-t" || arg == "-e" || arg == "-p" ||
+                         arg == "-x" || arg == "-w" || arg == "-o";
+        if (has_value && i + 1 < argc) {
+            string value = argv[++i];
+            if (arg == "-n") iterations = max(1, atoi(value.c_str()));
+            else if (arg == "-s") synthetic_size = strtoull(value.c_str(), NULL, 10);
+            else if (arg == "-b") compress_options.block_size = strtoull(value.c_str(), NULL, 10);
+            else if (arg == "-l") compress_options.level = atoi(value.c_str());
+            else if (arg == "-t") compress_options.threads = decompress_options.threads = atoi(value.c_str());
+            else if (arg == "-p") compress_options.pipeline_depth = max(1, atoi(value.c_str()));
+            else if (arg == "-x") compress_options.contexts = atoi(value.c_str());
+            else if (arg == "-w") compress_options.tokens = atoi(value.c_str());
+            else if (arg == "-e") {
+                if (!parse_backends(value, backends)) {
+                    usage();
+                    return 2;
+                }
+            } else json_path = value;
+        } else if (arg == "-c") {
+            compress_options.checksums = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            usage();
+            return 2;
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    char work_template[] = "/tmp/huf-bench-XXXXXX";
+    if (!mkdtemp(work_template)) {
+        cerr << "Error: Could not create a scratch directory.\n";
+        return 1;
+    }
+    string work = work_template;
+
+    vector<Input> inputs;
+    const char *synthetic[] = {"random", "skewed", "text", "single", "empty"};
+    for (const char *name : synthetic) {
+        Input input = {name, work + "/" + name + ".bin"};
+        if (!write_file(input.path, make_input(name, synthetic_size))) {
+            cerr << "Error: Could not write " << input.path << "\n";
+            return 1;
+        }
+        inputs.push_back(input);
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        string base = files[i].substr(files[i].find_last_of('/') + 1);
+        inputs.push_back({"file" + to_string(i) + "_" + base, files[i]});
+    }
+
+    vector<Result> results;
+    bool all_verified = true;
+    for (const Input &input : inputs) {
+        for (int backend : backends) {
+            CompressOptions options = compress_options;
+            options.backend = backend;
+            Result result = run_input(input, work, iterations, options, decompress_options);
+            result.backend = backend_names[backend];
+            all_verified = all_verified && result.verified;
+            if (result.size >= 0) {
+                fprintf(stderr, "%-24s %-8s %12lld -> %12lld  compress %8.1f MB/s  decompress %8.1f MB/s  %s\n",
+                        input.name.c_str(), result.backend.c_str(), result.size, result.compressed_size,
+                        median_speed(result.compress_seconds, result.size), median_speed(result.decompress_seconds, result.size),
+                        result.verified ? "ok" : "ROUND TRIP FAILED");
+            }
+            results.push_back(result);
+        }
+    }
+    for (const char *name : synthetic) unlink((work + "/" + name + ".bin").c_str());
+    rmdir(work.c_str());
+
+    stringstream json;
+    json << "{\"iterations\": " << iterations << ", \"block_size\": " << compress_options.block_size
+         << ", \"level\": " << compress_options.level << ", \"contexts\": " << compress_options.contexts
+         << ", \"tokens\": " << compress_options.tokens << ", \"checksums\": " << (compress_options.checksums ? "true" : "false")
+         << ", \"threads\": " << compress_options.threads << ", \"pipeline_depth\": " << compress_options.pipeline_depth
+         << ", \"inputs\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        json << (i ? ",\n  " : "\n  ") << "{\"name\": " << json_string(r.input.name) << ", \"path\": " << json_string(r.input.path)
+             << ", \"backend\": " << json_string(r.backend) << ", \"size\": " << r.size << ", \"compressed_size\": " << r.compressed_size << ", \"ratio\": "
+             << (r.size > 0 ? (double)r.compressed_size / r.size : 0) << ", \"verified\": " << (r.verified ? "true" : "false");
+        if (!r.compress_seconds.empty()) {
+            json << ", \"compress\": ";
+            write_timings(json, r.compress_seconds, r.size);
+            json << ", \"decompress\": ";
+            write_timings(json, r.decompress_seconds, r.size);
+            json << ", \"pipeline\": {";
+            for (int stage = 0; stage < Stage_count; stage++)
+                json << (stage ? ", " : "") << "\"" << stageName(stage) << "\": {\"stall_ms\": " << r.stall_ms[stage]
+                     << ", \"queue_peak\": " << r.queue_peak[stage] << "}";
+            json << "}";
+        }
+        //compressed size and median speeds as a multiple of the Huffman run of the same input
+        const Result *huffman = NULL;
+        for (const Result &other : results)
+            if (other.input.name == r.input.name && other.backend == backend_names[Backend_huffman]) huffman = &other;
+        if (huffman && huffman != &r && !r.compress_seconds.empty() && huffman->compressed_size > 0) {
+            double compress = median_speed(huffman->compress_seconds, r.size), decompress = median_speed(huffman->decompress_seconds, r.size);
+            json << ", \"vs_huffman\": {\"size\": " << (double)r.compressed_size / huffman->compressed_size
+                 << ", \"compress_speed\": " << (compress > 0 ? median_speed(r.compress_seconds, r.size) / compress : 0)
+                 << ", \"decompress_speed\": " << (decompress > 0 ? median_speed(r.decompress_seconds, r.size) / decompress : 0) << "}";
+        }
+        json << "}";
+    }
+    json << "\n]}\n";
+
+    if (json_path.empty()) {
+        cout << json.str();
+    } else {
+        ofstream out(json_path.c_str());
+        out << json.str();
+        if (!out) {
+            cerr << "Error: Could not write " << json_path << "\n";
+            return 1;
+        }
+    }
+    return all_verified ? 0 : 1;
+}
@@ -0,0 +1,526 @@
+// Compression daemon: listens on a Unix domain socket and compresses or decompresses buffers
+// and files sent to it. Worker threads, their scratch memory and a trained dictionary stay warm
+// from one request to the next, so small requests do not pay for starting a process. Builds
+// without FLTK:
+//   g++ -std=c++17 -O2 -pthread -o hufd hufd.cpp Encode.cpp Decode.cpp CodeTable.cpp Histogram.cpp Lz.cpp Ans.cpp Context.cpp Tokens.cpp Dictionary.cpp Checksum.cpp ThreadPool.cpp FileIO.cpp
+//
+// Requests and responses are frames of a 9-byte header and a payload, numbers little endian:
+//   request:  op (1), id (4), payload length (4), payload
+//   response: status (1), id (4), payload length (4), payload
+// Ops: 'c' / 'd' compress or decompress the payload, 'C' / 'D' the file named by a payload of
+// "input\0output", 's' latency percentiles as JSON. Status 0 on success, otherwise the payload
+// is an error message. Requests of one connection are answered as they finish, not always in
+// the order they were sent, so clients match responses by id.
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Encode.h"
+#include "Decode.h"
+#include "Dictionary.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+#define Frame_header_size 9
+#define Max_payload (1u << 30)          // larger requests are refused
+#define Max_output ((uint64_t)1 << 32)  // nor is anything decompressed to more than this
+#define Small_request (64 << 10)        // requests up to this size are batched
+#define Batch_max 64                    // requests taken by a worker at once
+#define Queue_budget (256u << 20)       // bytes of requests read but not answered yet, readers wait beyond it
+#define Outgoing_budget (256u << 20)    // bytes of responses queued on one connection, its reader waits beyond it
+#define Send_timeout 30                 // seconds a client may go without reading before it is dropped
+#define Latency_samples (1 << 16)       // most recent latencies kept for the percentiles of each op
+
+#define Op_compress 0
+#define Op_decompress 1
+#define Op_compress_file 2
+#define Op_decompress_file 3
+#define Op_count 4
+
+static const char *const op_names[Op_count] = {"compress", "decompress", "compress_file", "decompress_file"};
+
+// One client. Workers queue its responses and a writer thread of its own sends them, so a client
+// that does not read its responses only holds up itself
+struct Connection {
+    int fd;
+    mutex lock;
+    condition_variable changed; // responses queued or sent, reading ended or the writer failed
+    deque<vector<unsigned char>> outgoing; // frames waiting for the writer
+    size_t outgoing_bytes = 0;
+    size_t unanswered = 0; // requests read and not yet queued as responses
+    bool reading = true, closed = false; // closed once a send failed, later responses are dropped
+
+    // Wait until the responses queued are under the budget, false if the writer gave up
+    bool wait_for_room() {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [this] { return closed || outgoing_bytes <= Outgoing_budget; });
+        return !closed;
+    }
+    void request_read() {
+        lock_guard<mutex> guard(lock);
+        unanswered++;
+    }
+    void reading_ended() {
+        {
+            lock_guard<mutex> guard(lock);
+            reading = false;
+        }
+        changed.notify_all();
+    }
+    // Queue the frames answering a number of requests, never waits for the client
+    void respond(vector<unsigned char> &&frames, size_t requests) {
+        {
+            lock_guard<mutex> guard(lock);
+            unanswered -= requests;
+            if (!closed) {
+                outgoing_bytes += frames.size();
+                outgoing.push_back(move(frames));
+            }
+        }
+        changed.notify_all();
+    }
+    // The next frames to send, false once everything read has been answered and sent
+    bool next(vector<unsigned char> &frames) {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [this] { return closed || !outgoing.empty() || (!reading && !unanswered); });
+        if (closed || outgoing.empty()) return false;
+        frames = move(outgoing.front());
+        outgoing.pop_front();
+        return true;
+    }
+    void sent(size_t bytes) {
+        {
+            lock_guard<mutex> guard(lock);
+            outgoing_bytes -= bytes;
+        }
+        changed.notify_all();
+    }
+    void close_writes() {
+        {
+            lock_guard<mutex> guard(lock);
+            closed = true;
+            outgoing.clear();
+            outgoing_bytes = 0;
+        }
+        changed.notify_all();
+    }
+};
+
+struct Request {
+    shared_ptr<Connection> connection;
+    uint8_t op;
+    uint32_t id;
+    vector<unsigned char> payload;
+    chrono::steady_clock::time_point received; // when the whole request was read
+};
+
+// Latencies in microseconds from a request being read to its response being ready, per op
+struct Latencies {
+    mutex lock;
+    vector<double> samples[Op_count]; // a ring of the most recent Latency_samples
+    uint64_t count[Op_count] = {};
+    uint64_t batches = 0, batched = 0; // worker wake-ups and the requests they took
+
+    void add(int op, double microseconds) {
+        lock_guard<mutex> guard(lock);
+        if (samples[op].size() < Latency_samples) samples[op].push_back(microseconds);
+        else samples[op][count[op] % Latency_samples] = microseconds;
+        count[op]++;
+    }
+    void add_batch(size_t requests) {
+        lock_guard<mutex> guard(lock);
+        batches++;
+        batched += requests;
+    }
+};
+
+// Nearest-rank percentile of sorted values
+static double percentile(const vector<double> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)(p / 100 * sorted.size() + 0.999999);
+    return sorted[min(max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+static string latency_json(Latencies &latencies) {
+    lock_guard<mutex> guard(latencies.lock);
+    stringstream json;
+    json << "{\"batches\": " << latencies.batches << ", \"mean_batch\": "
+         << (latencies.batches ? (double)latencies.batched / latencies.batches : 0) << ", \"latency_us\": {";
+    for (int op = 0; op < Op_count; op++) {
+        vector<double> sorted = latencies.samples[op];
+        sort(sorted.begin(), sorted.end());
+        json << (op ? ", " : "") << "\"" << op_names[op] << "\": {\"count\": " << latencies.count[op]
+             << ", \"p50\": " << percentile(sorted, 50) << ", \"p90\": " << percentile(sorted, 90)
+             << ", \"p99\": " << percentile(sorted, 99) << ", \"p99.9\": " << percentile(sorted, 99.9)
+             << ", \"max\": " << (sorted.empty() ? 0 : sorted.back()) << "}";
+    }
+    json << "}}";
+    return json.str();
+}
+
+static bool read_full(int fd, unsigned char *data, size_t size) {
+    while (size) {
+        ssize_t got = read(fd, data, size);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const unsigned char *data, size_t size) {
+    while (size) {
+        ssize_t put = send(fd, data, size, MSG_NOSIGNAL);
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return false;
+        data += put;
+        size -= put;
+    }
+    return true;
+}
+
+// Bytes a request holds until it is answered, counting a little for every request so that
+// empty ones are bounded too
+static size_t request_cost(size_t payload) { return payload + sizeof(Request); }
+
+// Queue of requests read from every connection, taken by the workers a batch at a time. The
+// requests read but not answered yet share a byte budget, so clients that send faster than
+// the workers keep up are held back in the socket instead of filling memory
+class RequestQueue {
+public:
+    // Wait until cost bytes fit in the budget and take them. A request larger than the whole
+    // budget gets it alone
+    void reserve(size_t cost) {
+        unique_lock<mutex> guard(lock);
+        room.wait(guard, [&] { return pending == 0 || pending + cost <= Queue_budget; });
+        pending += cost;
+    }
+    // Give back bytes taken by reserve, once their requests are answered or were never read
+    void release(size_t cost) {
+        {
+            lock_guard<mutex> guard(lock);
+            pending -= cost;
+        }
+        room.notify_all();
+    }
+
+    void push(Request &&request) {
+        {
+            lock_guard<mutex> guard(lock);
+            requests.push_back(move(request));
+        }
+        wake.notify_one();
+    }
+
+    // The next request, followed by more small ones while they keep coming. False when stopping
+    bool take(vector<Request> &batch) {
+        batch.clear();
+        unique_lock<mutex> guard(lock);
+        wake.wait(guard, [this] { return stopping || !requests.empty(); });
+        if (requests.empty()) return false;
+        do {
+            batch.push_back(move(requests.front()));
+            requests.pop_front();
+        } while (batch.front().payload.size() <= Small_request && batch.size() < Batch_max && !requests.empty() &&
+                 requests.front().payload.size() <= Small_request);
+        return true;
+    }
+
+    void stop() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+    }
+
+private:
+    deque<Request> requests;
+    mutex lock;
+    condition_variable wake, room;
+    bool stopping = false;
+    size_t pending = 0; // bytes taken by reserve and not yet released
+};
+
+// Encoder and decoder of one worker, their tables and buffers kept between requests
+struct Worker {
+    Encoder encoder;
+    Decoder decoder;
+    vector<unsigned char> out;
+
+    explicit Worker(const CompressOptions &options) : encoder(options) {}
+
+    // Run one request into out, false with an error message in out if it failed
+    bool run(const Request &request, const CompressOptions &options, Latencies &latencies) {
+        const vector<unsigned char> &in = request.payload;
+        auto fail = [&](const char *message) {
+            out.assign(message, message + strlen(message));
+            return false;
+        };
+        if (request.op == 'c') return encoder.compress(in.data(), in.size(), out) || fail("compression failed");
+        if (request.op == 'd') {
+            uint64_t original;
+            if (!Decoder::originalSize(in.data(), in.size(), original)) return fail("not a valid compressed buffer");
+            if (original > Max_output) return fail("original size too large");
+            return decoder.decompress(in.data(), in.size(), out) || fail("corrupt compressed buffer");
+        }
+        if (request.op == 'C' || request.op == 'D') {
+            const char *names = (const char *)in.data();
+            const char *split = (const char *)memchr(names, 0, in.size());
+            if (!split || split == names || split + 1 == names + in.size()) return fail("expected input\\0output file names");
+            string input(names, split), output(split + 1, names + in.size());
+            out.clear();
+            if (request.op == 'C') return compressFile(input, output, options) || fail("compression failed");
+            return decompressFile(input, output) || fail("decompression failed");
+        }
+        if (request.op == 's') {
+            string json = latency_json(latencies);
+            out.assign(json.begin(), json.end());
+            return true;
+        }
+        return fail("unknown op");
+    }
+};
+
+static int op_index(uint8_t op) {
+    switch (op) {
+    case 'c': return Op_compress;
+    case 'd': return Op_decompress;
+    case 'C': return Op_compress_file;
+    case 'D': return Op_decompress_file;
+    default: return -1;
+    }
+}
+
+// Run batches until the queue stops. Responses of a batch going to the same connection are
+// queued together, and the batch's bytes go back to the budget once they are queued
+static void worker_loop(RequestQueue &queue, const CompressOptions &options, Latencies &latencies) {
+    Worker worker(options);
+    vector<Request> batch;
+    struct Response {
+        shared_ptr<Connection> connection;
+        vector<unsigned char> frames;
+        size_t requests;
+    };
+    vector<Response> responses;
+    while (queue.take(batch)) {
+        latencies.add_batch(batch.size());
+        responses.clear();
+        for (const Request &request : batch) {
+            bool ok = worker.run(request, options, latencies);
+            size_t r = 0;
+            while (r < responses.size() && responses[r].connection != request.connection) r++;
+            if (r == responses.size()) responses.push_back({request.connection, vector<unsigned char>(), 0});
+            responses[r].requests++;
+            vector<unsigned char> &frame = responses[r].frames;
+            size_t at = frame.size();
+            frame.resize(at + Frame_header_size);
+            frame[at] = ok ? 0 : 1;
+            store_le32(&frame[at + 1], request.id);
+            store_le32(&frame[at + 5], worker.out.size());
+            frame.insert(frame.end(), worker.out.begin(), worker.out.end());
+        }
+        //recorded before the responses go out, so a stats request that follows sees them
+        auto now = chrono::steady_clock::now();
+        for (const Request &request : batch) {
+            int op = op_index(request.op);
+            if (op >= 0) latencies.add(op, chrono::duration<double, micro>(now - request.received).count());
+        }
+        for (Response &response : responses) response.connection->respond(move(response.frames), response.requests);
+        responses.clear(); //nor does a worker keep a connection from being closed
+        size_t cost = 0;
+        for (const Request &request : batch) cost += request_cost(request.payload.size());
+        batch.clear(); //the payloads are freed before their bytes go back to the budget
+        queue.release(cost);
+    }
+}
+
+// Read the requests of one connection until it closes or sends a frame that is too large. While
+// too many of its responses wait to be sent, it is not read further
+static void read_loop(shared_ptr<Connection> connection, RequestQueue &queue) {
+    unsigned char header[Frame_header_size];
+    while (connection->wait_for_room() && read_full(connection->fd, header, Frame_header_size)) {
+        uint32_t length = load_le32(header + 5);
+        if (length > Max_payload) break;
+        queue.reserve(request_cost(length)); //before the payload is read or even allocated
+        Request request;
+        request.connection = connection;
+        request.op = header[0];
+        request.id = load_le32(header + 1);
+        request.payload.resize(length);
+        if (!read_full(connection->fd, request.payload.data(), length)) {
+            queue.release(request_cost(length));
+            break;
+        }
+        request.received = chrono::steady_clock::now();
+        connection->request_read();
+        queue.push(move(request));
+    }
+    connection->reading_ended();
+}
+
+// Send the responses of one connection until every request read is answered. A client that
+// takes nothing for Send_timeout is dropped
+static void write_loop(shared_ptr<Connection> connection) {
+    vector<unsigned char> frames;
+    while (connection->next(frames)) {
+        if (!write_full(connection->fd, frames.data(), frames.size())) {
+            connection->close_writes();
+            break;
+        }
+        connection->sent(frames.size());
+    }
+    shutdown(connection->fd, SHUT_RDWR); //also ends the reader if it is still waiting for requests
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+static void usage() {
+    cerr << "Usage: hufd [-s socket path] [-t worker threads] [-l LZ level] [-e huffman,ans,auto] [-x context tables]\n"
+            "            [-w byte pair tokens] [-c] [-k dictionary.hufc]\n";
+}
+
+int main(int argc, char **argv) {
+    string socket_path = "/tmp/hufd.sock", dictionary_path;
+    int workers = 0;
+    CompressOptions options;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = arg == "-s" || arg == "-t" || arg == "-l" || arg == "-e" || arg == "-x" || arg == "-w" || arg == "-k";
+        if (has_value && i + 1 < argc) {
+            string value = argv[++i];
+            if (arg == "-s") socket_path = value;
+            else if (arg == "-t") workers = atoi(value.c_str());
+            else if (arg == "-l") options.level = atoi(value.c_str());
+            else if (arg == "-x") options.contexts = atoi(value.c_str());
+            else if (arg == "-w") options.tokens = atoi(value.c_str());
+            else if (arg == "-k") dictionary_path = value;
+            else if (value == "huffman") options.backend = Backend_huffman;
+            else if (value == "ans") options.backend = Backend_ans;
+            else if (value == "auto") options.backend = Backend_auto;
+            else {
+                usage();
+                return 2;
+            }
+        } else if (arg == "-c") {
+            options.checksums = true;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (workers <= 0) workers = max(1u, thread::hardware_concurrency());
+
+    //a dictionary is loaded and its decode table built once, then every buffer is coded with it
+    Dictionary dictionary;
+    if (!dictionary_path.empty()) {
+        if (!loadDictionary(dictionary_path, dictionary) || !registerDictionary(dictionary)) {
+            cerr << "Error: Could not load the dictionary " << dictionary_path << "\n";
+            return 1;
+        }
+        options.dictionary = &dictionary;
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        cerr << "Error: Socket path too long: " << socket_path << "\n";
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path.c_str());
+    //a stale socket from an earlier run is replaced, anything else at the path is left alone
+    struct stat existing;
+    if (lstat(socket_path.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            cerr << "Error: " << socket_path << " exists and is not a socket.\n";
+            return 1;
+        }
+        unlink(socket_path.c_str());
+    }
+    //requests name files to read and write with the daemon's rights, so only its own user may connect
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t old_mask = umask(0077);
+    bool bound = listener >= 0 && bind(listener, (sockaddr *)&address, sizeof(address)) == 0;
+    umask(old_mask);
+    if (!bound || chmod(socket_path.c_str(), 0600) != 0 || listen(listener, 64) < 0) {
+        cerr << "Error: Could not listen on " << socket_path << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+    //compressFile and decompressFile report to cout, which is not wanted for every request
+    cout.rdbuf(NULL);
+    ThreadPool::shared(); //started before the first file request instead of during it
+
+    RequestQueue queue;
+    Latencies latencies;
+    vector<thread> worker_threads;
+    for (int i = 0; i < workers; i++) worker_threads.emplace_back(worker_loop, ref(queue), cref(options), ref(latencies));
+    fprintf(stderr, "hufd: listening on %s with %d workers\n", socket_path.c_str(), workers);
+
+    struct Client {
+        shared_ptr<Connection> connection;
+        thread reader, writer;
+    };
+    vector<Client> clients;
+    while (!stop_requested) {
+        pollfd waiting = {listener, POLLIN, 0};
+        int ready = poll(&waiting, 1, 200); //wakes up now and then to see a stop request
+        //connections whose reader and writer have both finished are joined and closed
+        for (size_t c = 0; c < clients.size();) {
+            if (clients[c].connection.use_count() == 1) {
+                clients[c].reader.join();
+                clients[c].writer.join();
+                close(clients[c].connection->fd);
+                clients.erase(clients.begin() + c);
+            } else {
+                c++;
+            }
+        }
+        if (ready <= 0) continue;
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) continue;
+        timeval timeout = {Send_timeout, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        shared_ptr<Connection> connection = make_shared<Connection>();
+        connection->fd = fd;
+        clients.push_back({connection, thread(read_loop, connection, ref(queue)), thread(write_loop, connection)});
+    }
+
+    close(listener);
+    unlink(socket_path.c_str());
+    //readers stop, the workers answer what was read, then the writers finish or fail on the closed sockets
+    for (Client &client : clients) shutdown(client.connection->fd, SHUT_RDWR);
+    for (Client &client : clients) client.reader.join();
+    queue.stop();
+    for (thread &worker : worker_threads) worker.join();
+    for (Client &client : clients) client.writer.join();
+    for (Client &client : clients) close(client.connection->fd);
+    fprintf(stderr, "%s\n", latency_json(latencies).c_str());
+    return 0;
+}
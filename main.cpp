@@ -1,3 +1,4 @@
+#include <FL/Fl.H>
 #include <FL/Fl_Window.H>
 #include <FL/Fl_File_Chooser.H>
 #include <FL/Fl_Button.H>
@@ -6,29 +7,91 @@
 #include <FL/Fl_Text_Display.H>
 #include <FL/fl_draw.H>
 #include <FL/Fl_Chart.H>
+#include <FL/Fl_Progress.H>
 #include <vector>
+#include <deque>
 #include <iostream>
 #include <chrono>
 #include <cstdio>
 #include <sstream>
+#include <thread>
 #include "Encode.h"
 #include "Decode.h"
+#include "Archive.h"
 #include <iomanip>
 //FLTK header for GUI, standar headers and Encode.h and Decode.h that contain CompressFile and DecompressFile functions
 using namespace std;
 
+#define Graph_points 512  // most recent jobs drawn on the graph, older ones drop off
+#define Speed_buckets 240 // points of the MB/s curve, a long job is averaged down to this many
+
 class CompressionGraph : public Fl_Widget { //class to show graph of compression ratios
 private:
-    vector<pair<long long, long long>> points; // Input size, Output size pairs
+    pair<long long, long long> points[Graph_points]; // Input size, Output size pairs, a ring of the latest
+    int first, count;  // oldest point in the ring and the number held
+    long long added;   // points added since the graph was cleared
+    deque<pair<long long, long long>> maxima; // (point number, size) of the points held that no later point
+                                              // is as large as, so the front is the largest
     long long max_size;
+    double speed[Speed_buckets]; // MB/s of the running or last job over time, every bucket the same length
+    int speed_count;
+    int per_bucket;            // progress samples averaged into one bucket, doubles when the buckets fill up
+    double pending;            // sum of the samples of the bucket being filled
+    int pending_samples;
+    double speed_peak;         // largest bucket, the scale of the curve
+    double speed_seconds;      // time the curve covers
 
 public:
     CompressionGraph(int x, int y, int w, int h, const char* l = 0) 
-        : Fl_Widget(x, y, w, h, l), max_size(1) {}
+        : Fl_Widget(x, y, w, h, l), first(0), count(0), added(0), max_size(1) {
+        start_speed();
+    }
 
     void clear_points() {
-        points.clear();
+        first = count = 0;
+        added = 0;
+        maxima.clear();
         max_size = 1;
+        start_speed();
+        redraw();
+    }
+
+    // Start the MB/s curve of a new job
+    void start_speed() {
+        speed_count = 0;
+        per_bucket = 1;
+        pending = 0;
+        pending_samples = 0;
+        speed_peak = 0;
+        speed_seconds = 0;
+        redraw();
+    }
+
+    // Speed sampled seconds into the running job. When the buckets are full every two are
+    // merged into one, so drawing the curve costs the same however long the job runs
+    void add_speed(double seconds, double megabytes_per_second) {
+        speed_seconds = seconds;
+        pending += megabytes_per_second;
+        if (++pending_samples < per_bucket) return;
+        double value = pending / pending_samples;
+        pending = 0;
+        pending_samples = 0;
+        if (speed_count == Speed_buckets) {
+            speed_peak = 0;
+            for (int i = 0; i < Speed_buckets / 2; i++) {
+                speed[i] = (speed[2 * i] + speed[2 * i + 1]) / 2;
+                speed_peak = max(speed_peak, speed[i]);
+            }
+            speed_count = Speed_buckets / 2;
+            //the new value is only half a bucket now, it waits for the other half
+            pending = value * per_bucket;
+            pending_samples = per_bucket;
+            per_bucket *= 2;
+            redraw();
+            return;
+        }
+        speed[speed_count++] = value;
+        speed_peak = max(speed_peak, value);
         redraw();
     }
 
@@ -99,12 +162,32 @@ public:
         fl_draw(scale_label, graph_x - 35, y_pos + 5);
     }
 
+    // Drawing the MB/s curve of the last job over time, across the whole width, with its scale on the right
+    if (speed_count >= 2) {
+        double scale = 1, steps[] = {2, 2.5, 2}; //1, 2, 5, 10, 20, 50 ...
+        for (int step = 0; scale < speed_peak; step++) scale *= steps[step % 3];
+        fl_color(FL_BLUE);
+        fl_font(FL_HELVETICA, 10);
+        for (int i = 1; i <= 4; i++) {
+            snprintf(scale_label, sizeof(scale_label), "%g", scale * i / 4);
+            fl_draw(scale_label, graph_x + graph_w + 4, graph_y - (i * graph_h / 4) + 5);
+        }
+        snprintf(scale_label, sizeof(scale_label), "MB/s, %.1f s", speed_seconds);
+        fl_draw(scale_label, graph_x + graph_w - 70, y() + 35);
+        fl_line_style(FL_SOLID, 1);
+        fl_begin_line();
+        for (int i = 0; i < speed_count; i++)
+            fl_vertex(graph_x + (double)i * graph_w / (speed_count - 1), graph_y - speed[i] * graph_h / scale);
+        fl_end_line();
+    }
+
     // Drawing points and line
-    if (!points.empty()) {
+    if (count) {
         fl_color(FL_RED);
         fl_line_style(FL_SOLID, 2);
         fl_begin_line();
-        for (const auto& point : points) {
+        for (int i = 0; i < count; i++) {
+            const auto& point = points[(first + i) % Graph_points];
             int px = graph_x + (point.first * graph_w) / max_size;
             int py = graph_y - (point.second * graph_h) / max_size;
             fl_circle(px, py, 4);
@@ -113,8 +196,8 @@ public:
         fl_end_line();
 
         // Drawing compression ratio with KB units
-        if (points.size() >= 2) {
-            auto& last_point = points.back();
+        if (count >= 2) {
+            auto& last_point = points[(first + count - 1) % Graph_points];
             double ratio = (double)last_point.second / last_point.first * 100;
             double input_kb = last_point.first / 1024.0;
             double output_kb = last_point.second / 1024.0;
@@ -130,13 +213,17 @@ public:
 
 // Updating the add_point method to store sizes in bytes but display in KB
 void add_point(long long input_size, long long output_size) {
-    points.push_back({input_size, output_size});
-    max_size = 1024; // Start with minimum 1KB scale
+    if (count == Graph_points) first = (first + 1) % Graph_points; //the oldest point makes room
+    else count++;
+    points[(first + count - 1) % Graph_points] = {input_size, output_size};
     
-    // Finding the maximum size in bytes to set the scale
-    for (const auto& point : points) {
-        max_size = max(max_size, max(point.first, point.second));
-    }
+    // Finding the maximum size in bytes to set the scale without scanning the points: a point
+    // leaves maxima once a later one is as large, or once it drops out of the ring
+    long long size = max(input_size, output_size);
+    while (!maxima.empty() && maxima.back().second <= size) maxima.pop_back();
+    maxima.push_back({added++, size});
+    if (maxima.front().first < added - Graph_points) maxima.pop_front();
+    max_size = max(1024LL, maxima.front().second); // Start with minimum 1KB scale
     
     // Round up max_size to the next nice number
     long long scale_kb = (max_size + 1023) / 1024;  // Converting to KB and round up
@@ -150,30 +237,65 @@ void add_point(long long input_size, long long output_size) {
 }
 };
 
+#define Progress_interval 0.1 // seconds between progress bar updates
+
+#define Job_compress 0   // file to .huf
+#define Job_decompress 1 // .huf to file
+#define Job_archive 2    // folder to .hufa archive
+#define Job_extract 3    // .hufa archive to folder
+
+// A compression or decompression running on a worker thread. The library reports progress
+// through the atomics in progress, and the worker posts Job_Finished with Fl::awake at the end
+struct Job {
+    int kind;
+    string input_file;
+    string output_file;
+    long long initial_size;
+    vector<ArchiveEntry> entries; // file table of an archive job
+    JobProgress progress;
+    JobStats stats;
+    bool success = false;
+    chrono::steady_clock::time_point start;
+    uint64_t sampled_done = 0;    // progress at the last timer tick, for the MB/s curve
+    double sampled_seconds = 0;
+    thread worker;
+};
+
 class FileCompressorDecompressor {
 public:
     Fl_Window *window;
     Fl_Button *compress_button;
     Fl_Button *decompress_button;
     Fl_Button *clear_graph_button;
+    Fl_Button *archive_button;
+    Fl_Button *extract_button;
     Fl_Input *input_file_path;
     Fl_Input *output_file_path;
     Fl_Box *header;
     Fl_Text_Display *status_display;
     Fl_Text_Buffer *status_buffer;
     CompressionGraph *graph;
+    Fl_Progress *progress_bar;
+    Fl_Button *cancel_button;
+    Job *job; // running job, nullptr when idle
+    char progress_label[64];
 
     FileCompressorDecompressor(int width, int height, const char *title) //creates widgets for I/O fields, buttons, status display and compression graph
         : window(new Fl_Window(width, height, title)),
           compress_button(new Fl_Button(50, 150, 150, 40, "Compress File")),
           decompress_button(new Fl_Button(210, 150, 150, 40, "Decompress File")),
           clear_graph_button(new Fl_Button(370, 150, 150, 40, "Clear Graph")),
+          archive_button(new Fl_Button(460, 50, 130, 30, "Compress Folder")),
+          extract_button(new Fl_Button(460, 100, 130, 30, "Extract Archive")),
           input_file_path(new Fl_Input(150, 50, 300, 30, "Input File Path:")),
           output_file_path(new Fl_Input(150, 100, 300, 30, "Output File Path:")),
           header(new Fl_Box(FL_NO_BOX, 50, 10, 400, 40, "Huffman Compressor/Decompressor")),
           status_buffer(new Fl_Text_Buffer()),
           status_display(new Fl_Text_Display(50, 460, 500, 120, "Status:")),
-          graph(new CompressionGraph(50, 210, 500, 230, "Compression Ratio Graph")) {
+          graph(new CompressionGraph(50, 210, 500, 230, "Compression Ratio Graph")),
+          progress_bar(new Fl_Progress(50, 595, 390, 30)),
+          cancel_button(new Fl_Button(450, 595, 100, 30, "Cancel")),
+          job(nullptr) {
 
         // Set window settings
         window->size(width, height);
@@ -197,19 +319,42 @@ public:
         status_display->color(FL_BLACK);
         status_display->textcolor(FL_GREEN);
 
+        // Progress bar settings
+        progress_bar->minimum(0);
+        progress_bar->maximum(100);
+        progress_bar->value(0);
+        progress_bar->selection_color(fl_rgb_color(189, 6, 10));
+        progress_label[0] = '\0';
+
         // Style buttons
         customize_button(compress_button, FL_ROUNDED_BOX, 16, fl_rgb_color(189, 6, 10), FL_WHITE);
         customize_button(decompress_button, FL_ROUNDED_BOX, 16, fl_rgb_color(189, 6, 10), FL_WHITE);
         customize_button(clear_graph_button, FL_ROUNDED_BOX, 16, fl_rgb_color(100, 100, 100), FL_WHITE);
+        customize_button(archive_button, FL_ROUNDED_BOX, 14, fl_rgb_color(189, 6, 10), FL_WHITE);
+        customize_button(extract_button, FL_ROUNDED_BOX, 14, fl_rgb_color(189, 6, 10), FL_WHITE);
+        customize_button(cancel_button, FL_ROUNDED_BOX, 14, fl_rgb_color(100, 100, 100), FL_WHITE);
+        cancel_button->deactivate();
 
         // Callbacks
         compress_button->callback(Compress_Callback, this);
         decompress_button->callback(Decompress_Callback, this);
         clear_graph_button->callback(Clear_Graph_Callback, this);
+        archive_button->callback(Archive_Callback, this);
+        extract_button->callback(Extract_Callback, this);
+        cancel_button->callback(Cancel_Callback, this);
 
         window->end();
     }
 
+    // A job still running when the window closes is cancelled, which removes its output
+    ~FileCompressorDecompressor() {
+        if (job) {
+            job->progress.cancel = true;
+            job->worker.join();
+            delete job;
+        }
+    }
+
     void show() {
         window->show();
     }
@@ -254,34 +399,7 @@ private:
             updateStatus(fc, "Error: Could not read input file size\n");
             return;
         }
-        //time calculation
-        auto start = std::chrono::high_resolution_clock::now();
-        bool success = compressFile(fc->input_file_path->value(), fc->output_file_path->value());
-        auto end = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-
-        if (success) {
-            long long final_size = getFileSize(output_file);
-            if (final_size == -1) {
-                updateStatus(fc, "File compressed but couldn't read compressed size\n");
-                return;
-            }
-
-            // Add point to graph
-            fc->graph->add_point(initial_size, final_size);
-
-            double ratio = (double)final_size / initial_size * 100;
-            stringstream ss;
-            ss << "Compression Successful!\n"
-               << "Initial size: " << initial_size << " bytes\n"
-               << "Final size: " << final_size << " bytes\n"
-               << "Compression ratio: " << fixed << setprecision(2) << ratio << "%\n"
-               << "Time taken: " << duration.count() << " ms\n\n";
-
-            updateStatus(fc, ss.str());
-        } else {
-            updateStatus(fc, "Error: File compression failed\n\n");
-        }
+        start_job(fc, Job_compress, initial_size);
     }
 
     static void Decompress_Callback(Fl_Widget *widget, void *data) {
@@ -304,13 +422,194 @@ private:
             return;
         }
 
-        auto start = std::chrono::high_resolution_clock::now(); //record start time 
-        bool success = decompressFile(fc->input_file_path->value(), fc->output_file_path->value()); //call decompressFile, passing the input and output and store the value in success
-        auto end = std::chrono::high_resolution_clock::now(); //record end time
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        start_job(fc, Job_decompress, initial_size);
+    }
+
+    static void Archive_Callback(Fl_Widget *widget, void *data) {
+        FileCompressorDecompressor *fc = (FileCompressorDecompressor *)data;
+
+        const char *input_folder = fl_dir_chooser("Select a folder to compress", nullptr);
+        if (!input_folder) return;
+        fc->input_file_path->value(input_folder);
+
+        const char *output_file = fl_file_chooser("Save archive as", "*.hufa", nullptr);
+        if (!output_file) return;
+        fc->output_file_path->value(output_file);
+
+        fc->status_buffer->text("");
+        start_job(fc, Job_archive, 0); //the sizes come from the file table at the end
+    }
+
+    static void Extract_Callback(Fl_Widget *widget, void *data) {
+        FileCompressorDecompressor *fc = (FileCompressorDecompressor *)data;
+
+        const char *input_file = fl_file_chooser("Select an archive", "*.hufa", nullptr);
+        if (!input_file) return;
+        fc->input_file_path->value(input_file);
+        long long initial_size = getFileSize(input_file);
 
-        if (success) { //if decompressionn is successful
-            long long final_size = getFileSize(output_file);
+        const char *output_folder = fl_dir_chooser("Extract into folder", nullptr);
+        if (!output_folder) return;
+        fc->output_file_path->value(output_folder);
+
+        fc->status_buffer->text("");
+
+        if (initial_size == -1) {
+            updateStatus(fc, "Error: Could not read archive size\n");
+            return;
+        }
+        start_job(fc, Job_extract, initial_size);
+    }
+
+    static void Cancel_Callback(Fl_Widget *widget, void *data) {
+        FileCompressorDecompressor *fc = (FileCompressorDecompressor *)data;
+        if (!fc->job) return;
+        fc->job->progress.cancel = true; //the worker stops before its next block
+        fc->cancel_button->deactivate();
+        updateStatus(fc, "Cancelling...\n");
+    }
+
+    // Run the job on a worker thread so the window stays responsive. A timer shows its progress
+    // until the worker posts Job_Finished
+    static void start_job(FileCompressorDecompressor *fc, int kind, long long initial_size) {
+        static const char *const messages[] = {"Compressing...\n", "Decompressing...\n", "Compressing folder...\n",
+                                               "Extracting archive...\n"};
+        Job *job = new Job();
+        job->kind = kind;
+        job->input_file = fc->input_file_path->value();
+        job->output_file = fc->output_file_path->value();
+        job->initial_size = initial_size;
+        job->start = chrono::steady_clock::now();
+        fc->job = job;
+        fc->set_running(true);
+        fc->graph->start_speed();
+        updateStatus(fc, messages[kind]);
+
+        job->worker = thread([fc, job]() {
+            CompressOptions compress_options;
+            DecompressOptions decompress_options;
+            compress_options.progress = &job->progress;
+            decompress_options.progress = &job->progress;
+            compress_options.stats = &job->stats;
+            decompress_options.stats = &job->stats;
+            if (job->kind == Job_compress) {
+                job->success = compressFile(job->input_file, job->output_file, compress_options);
+            } else if (job->kind == Job_decompress) {
+                job->success = decompressFile(job->input_file, job->output_file, decompress_options);
+            } else if (job->kind == Job_archive) {
+                job->success = compressDirectory(job->input_file, job->output_file, compress_options, job->entries);
+            } else {
+                job->success = extractArchive(job->input_file, job->output_file, decompress_options) &&
+                               listArchive(job->input_file, job->entries);
+            }
+            Fl::awake(Job_Finished, fc);
+        });
+        Fl::add_timeout(Progress_interval, Progress_Timer, fc);
+    }
+
+    // Buttons that start jobs are disabled while one runs, and the cancel button only then
+    void set_running(bool running) {
+        if (running) {
+            compress_button->deactivate();
+            decompress_button->deactivate();
+            clear_graph_button->deactivate();
+            archive_button->deactivate();
+            extract_button->deactivate();
+            cancel_button->activate();
+        } else {
+            compress_button->activate();
+            decompress_button->activate();
+            clear_graph_button->activate();
+            archive_button->activate();
+            extract_button->activate();
+            cancel_button->deactivate();
+        }
+        progress_bar->value(0);
+        progress_label[0] = '\0';
+        progress_bar->label(progress_label);
+    }
+
+    static double megabytes_per_second(uint64_t bytes, double seconds) {
+        return seconds > 0 ? bytes / seconds / (1024 * 1024) : 0;
+    }
+
+    static void Progress_Timer(void *data) {
+        FileCompressorDecompressor *fc = (FileCompressorDecompressor *)data;
+        Job *job = fc->job;
+        if (!job) return;
+        uint64_t done = job->progress.done, total = job->progress.total;
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - job->start).count();
+        double percent = total ? 100.0 * done / total : 0;
+        fc->progress_bar->value(percent);
+        snprintf(fc->progress_label, sizeof(fc->progress_label), "%.0f%%  %.1f MB/s", percent,
+                 megabytes_per_second(done, seconds));
+        fc->progress_bar->label(fc->progress_label);
+        //the speed since the last tick goes on the curve, the label shows the average so far
+        if (seconds > job->sampled_seconds)
+            fc->graph->add_speed(seconds, megabytes_per_second(done - job->sampled_done, seconds - job->sampled_seconds));
+        job->sampled_done = done;
+        job->sampled_seconds = seconds;
+        Fl::repeat_timeout(Progress_interval, Progress_Timer, fc);
+    }
+
+    // Posted by the worker through Fl::awake, runs on the GUI thread
+    static void Job_Finished(void *data) {
+        FileCompressorDecompressor *fc = (FileCompressorDecompressor *)data;
+        Job *job = fc->job;
+        if (!job) return;
+        job->worker.join();
+        Fl::remove_timeout(Progress_Timer, fc);
+        fc->job = nullptr;
+        fc->set_running(false);
+        auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - job->start);
+
+        //a cancel that came after the last check did not stop the job, which kept its output
+        bool cancelled = job->progress.cancelled() && !job->success;
+        if (cancelled && job->kind == Job_extract)
+            updateStatus(fc, "Cancelled, files extracted so far were kept\n\n");
+        else if (cancelled)
+            updateStatus(fc, "Cancelled, the partial output was removed\n\n");
+        else if (job->kind == Job_compress)
+            report_compression(fc, *job, duration);
+        else if (job->kind == Job_decompress)
+            report_decompression(fc, *job, duration);
+        else
+            report_archive(fc, *job, duration);
+        delete job;
+    }
+
+    static void report_compression(FileCompressorDecompressor *fc, const Job &job, chrono::milliseconds duration) {
+        long long initial_size = job.initial_size;
+        if (job.success) {
+            long long final_size = getFileSize(job.output_file.c_str());
+            if (final_size == -1) {
+                updateStatus(fc, "File compressed but couldn't read compressed size\n");
+                return;
+            }
+
+            // Add point to graph
+            fc->graph->add_point(initial_size, final_size);
+
+            double ratio = (double)final_size / initial_size * 100;
+            stringstream ss;
+            ss << "Compression Successful!\n"
+               << "Initial size: " << initial_size << " bytes\n"
+               << "Final size: " << final_size << " bytes\n"
+               << "Compression ratio: " << fixed << setprecision(2) << ratio << "%\n"
+               << "Time taken: " << duration.count() << " ms\n"
+               << "Speed: " << megabytes_per_second(initial_size, duration.count() / 1000.0) << " MB/s\n"
+               << stats_report(job.stats) << "\n";
+
+            updateStatus(fc, ss.str());
+        } else {
+            updateStatus(fc, "Error: File compression failed\n\n");
+        }
+    }
+
+    static void report_decompression(FileCompressorDecompressor *fc, const Job &job, chrono::milliseconds duration) {
+        long long initial_size = job.initial_size;
+        if (job.success) { //if decompressionn is successful
+            long long final_size = getFileSize(job.output_file.c_str());
             if (final_size == -1) {
                 updateStatus(fc, "File decompressed but couldn't read decompressed size\n");
                 return;
@@ -322,7 +621,9 @@ private:
                << "Decompressed size: " << final_size << " bytes\n"
                << "Expansion ratio: " << fixed << setprecision(2) 
                << ((double)final_size / initial_size * 100) << "%\n"
-               << "Time taken: " << duration.count() << " ms\n\n";
+               << "Time taken: " << duration.count() << " ms\n"
+               << "Speed: " << megabytes_per_second(final_size, duration.count() / 1000.0) << " MB/s\n"
+               << stats_report(job.stats) << "\n";
 
             updateStatus(fc, ss.str());
         } else {
@@ -330,6 +631,55 @@ private:
         }
     }
 
+    // Archive jobs add a graph point per file and report the throughput over all of them
+    static void report_archive(FileCompressorDecompressor *fc, const Job &job, chrono::milliseconds duration) {
+        bool archive = job.kind == Job_archive;
+        if (!job.success) {
+            updateStatus(fc, archive ? "Error: Folder compression failed\n\n" : "Error: Archive extraction failed\n\n");
+            return;
+        }
+        long long original = 0, compressed = 0;
+        for (const ArchiveEntry &entry : job.entries) {
+            original += entry.size;
+            compressed += entry.compressed_size;
+            if (archive) fc->graph->add_point(entry.size, entry.compressed_size);
+        }
+
+        stringstream ss;
+        ss << (archive ? "Folder Compression Successful!\n" : "Extraction Successful!\n")
+           << "Files: " << job.entries.size() << "\n"
+           << "Original size: " << original << " bytes\n"
+           << "Compressed size: " << compressed << " bytes\n"
+           << "Compression ratio: " << fixed << setprecision(2) << (original ? (double)compressed / original * 100 : 0) << "%\n"
+           << "Time taken: " << duration.count() << " ms\n"
+           << "Speed: " << megabytes_per_second(original, duration.count() / 1000.0) << " MB/s\n"
+           << stats_report(job.stats) << "\n";
+        updateStatus(fc, ss.str());
+    }
+
+    // Time, bytes and speed of every phase the job went through, then the code lengths
+    static string stats_report(const JobStats &stats) {
+        stringstream ss;
+        ss << "Phases (summed over threads):\n" << fixed << setprecision(1);
+        for (int phase = 0; phase < Phase_count; phase++) {
+            if (!stats.nanoseconds[phase]) continue;
+            ss << "  " << left << setw(13) << phaseName(phase) << right << setw(9) << stats.seconds(phase) * 1000 << " ms "
+               << setw(9) << stats.megabytes_per_second(phase) << " MB/s\n";
+        }
+        if (stats.symbols)
+            ss << "Max code length: " << stats.max_code_length << " bits\n"
+               << "Average: " << setprecision(2) << stats.average_bits() << " bits per character\n";
+        bool pipelined = false;
+        for (int stage = 0; stage < Stage_count; stage++) pipelined = pipelined || stats.queue_peak[stage];
+        if (pipelined) { //time each stage waited on the one before it, and the most buffers it found waiting
+            ss << "Pipeline stalls:" << setprecision(1);
+            for (int stage = 0; stage < Stage_count; stage++)
+                ss << " " << stageName(stage) << " " << stats.stall_nanoseconds[stage] / 1e6 << " ms (queue " << stats.queue_peak[stage] << ")";
+            ss << "\n";
+        }
+        return ss.str();
+    }
+
     static void customize_button(Fl_Button *button, Fl_Boxtype boxtype, int labelsize, 
                                Fl_Color color, Fl_Color labelcolor) {
         button->box(boxtype);
@@ -341,7 +691,8 @@ private:
 };
 
 int main() {
-    FileCompressorDecompressor app(600, 600, "Huffman Compressor and Decompressor");
+    Fl::lock(); //lets the worker thread post Fl::awake
+    FileCompressorDecompressor app(600, 640, "Huffman Compressor and Decompressor");
     app.show();
     return Fl::run();
 }